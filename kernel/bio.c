@@ -38,7 +38,7 @@ binit(void)
 {
   struct buf *b;
 
-  initlock(&bcache.lock, "bcache");
+  initqlock(&bcache.lock, "bcache", LK_MCS);
 
   // Create linked list of buffers
   bcache.head.prev = &bcache.head;
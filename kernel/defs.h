@@ -6,6 +6,7 @@ struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
+struct kcache;
 struct stat;
 struct superblock;
 
@@ -63,6 +64,17 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void*           kalloc_order(int);
+void*           kalloc_zeroed(void);
+int             kzero(void);
+void            kfree_order(void *, int);
+void            kmemdump(void);
+
+// slab.c
+struct kcache*  kcache_create(char*, int);
+void*           kcache_alloc(struct kcache*);
+void            kcache_free(struct kcache*, void*);
+void            kcachedump(void);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -71,6 +83,7 @@ void            begin_op(void);
 void            end_op(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -85,8 +98,8 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+struct proc*    findproc(int);
 int             growproc(int);
-void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
@@ -102,14 +115,38 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
+void            wakeup_one(void*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
-void            update_time();
+void            chargetime(struct proc*);
+int             waitx(uint64, uint*, uint*);
+
+// sched.c
+void            runqinit(void);
+struct proc*    runq_pick(struct cpu*);
+int             runq_allowed(struct cpu*, struct proc*);
+void            runq_add(struct cpu*, struct proc*);
+void            runq_tick(void);
+void            resched_cpu(struct cpu*);
+int             runq_needresched(void);
+void            setrunnable(struct proc*);
 void            set_priority(int, int, int*);
+int             dynamic_priority(struct proc*);
 void            settickets(int);
-int             waitx(uint64, uint*, uint*);
+void            runq_putprev(struct proc*);
+int             runq_requeue(struct proc*);
+void            runq_start(struct proc*);
+int             runq_needtick(struct cpu*);
+void            runq_idle(struct cpu*);
+int             getsched(void);
+int             setsched(int);
+int             setdeadline(int, int, int);
+int             setaffinity(int, int);
+extern int      pi_inversions;
+void            pi_setrank(struct proc*, int);
+void            pi_lend(struct proc*, int*);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -118,6 +155,9 @@ void            swtch(struct context*, struct context*);
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            initqlock(struct spinlock*, char*, int);
+void            freelock(struct spinlock*);
+int             lockstat(uint64, int, int);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
@@ -145,12 +185,21 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// timer.c
+void            wheelinit(void);
+void            timer_run(void);
+uint64          timer_next(void);
+int             timer_sleep(uint64);
+
 // trap.c
 extern uint     ticks;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
+void            sendipi(struct cpu*, int);
+void            tlbshootdown(void);
+void            timerupdate(void);
 int             cowfault(pagetable_t, uint64);
 
 // uart.c
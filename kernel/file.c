@@ -14,15 +14,19 @@
 #include "proc.h"
 
 struct devsw devsw[NDEV];
+
+// Open files come from a slab cache, up to NFILE of them.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  int nfile;
+  struct kcache *cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  ftable.cache = kcache_create("file", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -32,15 +36,22 @@ filealloc(void)
   struct file *f;
 
   acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
+  if(ftable.nfile == NFILE){
+    release(&ftable.lock);
+    return 0;
   }
+  ftable.nfile++;
   release(&ftable.lock);
-  return 0;
+
+  if((f = kcache_alloc(ftable.cache)) == 0){
+    acquire(&ftable.lock);
+    ftable.nfile--;
+    release(&ftable.lock);
+    return 0;
+  }
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,9 +80,9 @@ fileclose(struct file *f)
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
+  ftable.nfile--;
   release(&ftable.lock);
+  kcache_free(ftable.cache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
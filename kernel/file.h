@@ -18,6 +18,8 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next; // Next inode in the table
+  struct inode *prev; // Previous inode in the table
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -169,28 +169,58 @@ bfree(int dev, uint b)
 // and ip->dev and ip->inum indicate which i-node an entry
 // holds, one must hold itable.lock while using any of those fields.
 //
+// The table is a list of up to NINODE inodes, allocated from a
+// slab cache. An inode whose last reference is dropped stays in
+// the list, valid, so the next iget() of it needn't read the disk;
+// the list is kept with the most recently dropped first, and when
+// the table is full iget() reuses the unreferenced inode furthest
+// down it. Only an inode that isn't valid goes back to the cache.
+//
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *head;
+  int ninode;
+  struct kcache *cache;
 } itable;
 
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  itable.cache = kcache_create("inode", sizeof(struct inode));
 }
 
 static struct inode* iget(uint dev, uint inum);
 
+// Put ip at the front of the table.
+// itable.lock must be held.
+static void
+itable_push(struct inode *ip)
+{
+  ip->prev = 0;
+  ip->next = itable.head;
+  if(itable.head)
+    itable.head->prev = ip;
+  itable.head = ip;
+}
+
+// Take ip out of the table.
+// itable.lock must be held.
+static void
+itable_remove(struct inode *ip)
+{
+  if(ip->prev)
+    ip->prev->next = ip->next;
+  else
+    itable.head = ip->next;
+  if(ip->next)
+    ip->next->prev = ip->prev;
+}
+
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode,
@@ -252,21 +282,28 @@ iget(uint dev, uint inum)
 
   // Is the inode already in the table?
   empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  for(ip = itable.head; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
       ip->ref++;
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
+    if(ip->ref == 0)    // Remember the least recently used.
       empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
+  // Allocate an inode entry, or recycle the least recently
+  // used one if the table is full.
+  if(itable.ninode < NINODE && (ip = kcache_alloc(itable.cache)) != 0){
+    itable.ninode++;
+    initsleeplock(&ip->lock, "inode");
+  } else if((ip = empty) != 0){
+    itable_remove(ip);
+  } else {
     panic("iget: no inodes");
+  }
+  itable_push(ip);
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
@@ -328,7 +365,7 @@ iunlock(struct inode *ip)
 
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode table entry can
-// be recycled.
+// be recycled, once it is the least recently used.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -357,7 +394,17 @@ iput(struct inode *ip)
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref == 0){
+    itable_remove(ip);
+    if(ip->valid){
+      // keep it cached, as the most recently used.
+      itable_push(ip);
+    } else {
+      itable.ninode--;
+      freelock(&ip->lock.lk);
+      kcache_free(itable.cache, ip);
+    }
+  }
   release(&itable.lock);
 }
 
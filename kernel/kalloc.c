@@ -1,6 +1,19 @@
 // Physical memory allocator, for user processes,
-// kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// kernel stacks, page-table pages, and slabs.
+//
+// A buddy allocator over end..PHYSTOP: a block of order k is
+// 2^k pages, aligned to its size, and its buddy is the block
+// of the same order it was split from. Allocating splits the
+// smallest free block that fits; freeing merges a block with
+// its buddy for as long as the buddy is free. kalloc() and
+// kfree() deal in single pages and honor the copy-on-write
+// reference counts in refcnt[]; kalloc_order() and
+// kfree_order() deal in physically contiguous blocks.
+//
+// Beside the buddy lists is a pool of up to NZEROPAGE pages
+// that are already zero, for kalloc_zeroed(); idle cpus fill
+// it with kzero(). Pages are filled with junk on allocation
+// and free only if the kernel is built with POISON.
 
 #include "types.h"
 #include "param.h"
@@ -14,13 +27,22 @@ void freerange(void *pa_start, void *pa_end);
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+#define MEGAORDER 9  // a 2MB megapage
+#define NPAGES ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PAGENO(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+
 struct run {
   struct run *next;
+  struct run *prev;
 };
 
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct run *freelist[MAXORDER+1]; // Free blocks of each order
+  int nfree[MAXORDER+1];            // Number of them
+  char freeorder[NPAGES];           // 1+order if the page heads a free block, else 0
+  struct run *zeroed;               // Zeroed pages, but for the link
+  int nzeroed;                      // Number of them
 } kmem;
 
 int refcnt[PHYSTOP / PGSIZE];
@@ -28,7 +50,7 @@ int refcnt[PHYSTOP / PGSIZE];
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
+  initqlock(&kmem.lock, "kmem", LK_MCS);
   freerange(end, (void*)PHYSTOP);
 }
 
@@ -55,6 +77,75 @@ addref(uint64 pa)
   release(&kmem.lock);
 }
 
+static void
+push(struct run *r, int order)
+{
+  r->prev = 0;
+  r->next = kmem.freelist[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.freelist[order] = r;
+  kmem.nfree[order]++;
+  kmem.freeorder[PAGENO(r)] = 1 + order;
+}
+
+static void
+unlink(struct run *r, int order)
+{
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.freelist[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.nfree[order]--;
+  kmem.freeorder[PAGENO(r)] = 0;
+}
+
+// Put a block on the free lists, merged with its buddy,
+// and the result with its own, as far as they are free.
+// kmem.lock must be held.
+static void
+buddy_free(uint64 pa, int order)
+{
+  uint64 buddy;
+
+  while(order < MAXORDER){
+    buddy = KERNBASE + ((pa - KERNBASE) ^ ((uint64)PGSIZE << order));
+    if(buddy >= PHYSTOP || kmem.freeorder[PAGENO(buddy)] != 1 + order)
+      break;
+    unlink((struct run*)buddy, order);
+    if(buddy < pa)
+      pa = buddy;
+    order++;
+  }
+  push((struct run*)pa, order);
+}
+
+// Take a block of the given order off the free lists,
+// splitting a bigger one if need be, or return 0.
+// kmem.lock must be held.
+static void*
+buddy_alloc(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k <= MAXORDER; k++)
+    if(kmem.freelist[k])
+      break;
+  if(k > MAXORDER)
+    return 0;
+  r = kmem.freelist[k];
+  unlink(r, k);
+  // give back the upper halves.
+  while(k > order){
+    k--;
+    push((struct run*)((char*)r + ((uint64)PGSIZE << k)), k);
+  }
+  return r;
+}
+
 // Free the page of physical memory pointed at by pa,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
@@ -62,8 +153,6 @@ addref(uint64 pa)
 void
 kfree(void *pa)
 {
-  struct run *r;
-
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
   acquire(&kmem.lock);
@@ -78,14 +167,13 @@ kfree(void *pa)
   if (0 < temp) {
     return;
   }
+#ifdef POISON
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
-
-  r = (struct run*)pa;
+#endif
 
   acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  buddy_free((uint64)pa, 0);
   release(&kmem.lock);
 }
 
@@ -94,13 +182,27 @@ kfree(void *pa)
 // Returns 0 if the memory cannot be allocated.
 void *
 kalloc(void)
+{
+  return kalloc_order(0);
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to their size. Only the first page is reference counted,
+// for kfree_order(). Returns 0 if there is no such block.
+void *
+kalloc_order(int order)
 {
   struct run *r;
 
+  if(order < 0 || order > MAXORDER)
+    panic("kalloc_order");
   acquire(&kmem.lock);
-  r = kmem.freelist;
+  r = buddy_alloc(order);
+  if (r == 0 && order == 0 && (r = kmem.zeroed) != 0) {
+    kmem.zeroed = r->next;
+    kmem.nzeroed--;
+  }
   if (r) {
-    kmem.freelist = r->next;
     int j = (uint64) r / PGSIZE;
     if (0 != refcnt[j]) {
       panic("kalloc: ref");
@@ -109,7 +211,111 @@ kalloc(void)
   }
   release(&kmem.lock);
 
+#ifdef POISON
   if(r)
-    memset((char*)r, 5, PGSIZE); // fill with junk
+    memset((char*)r, 5, (uint64)PGSIZE << order); // fill with junk
+#endif
   return (void*)r;
 }
+
+// Allocate one page of zeros, from the pool if it has any.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  if ((r = kmem.zeroed) != 0) {
+    kmem.zeroed = r->next;
+    kmem.nzeroed--;
+    int j = (uint64) r / PGSIZE;
+    if (0 != refcnt[j]) {
+      panic("kalloc_zeroed: ref");
+    }
+    refcnt[j] = 1;
+  }
+  release(&kmem.lock);
+
+  if(r){
+    r->next = 0;
+    return (void*)r;
+  }
+  if((r = kalloc()) != 0)
+    memset((char*)r, 0, PGSIZE);
+  return (void*)r;
+}
+
+// Zero a free page for the pool, if it is short of NZEROPAGE.
+// Returns 0 if there was nothing to do. Called by idle cpus;
+// two at once may overfill the pool by a page.
+int
+kzero(void)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  if(kmem.nzeroed >= NZEROPAGE || (r = buddy_alloc(0)) == 0){
+    release(&kmem.lock);
+    return 0;
+  }
+  release(&kmem.lock);
+
+  memset((char*)r, 0, PGSIZE);
+
+  acquire(&kmem.lock);
+  r->next = kmem.zeroed;
+  kmem.zeroed = r;
+  kmem.nzeroed++;
+  release(&kmem.lock);
+  return 1;
+}
+
+// Free a block from kalloc_order() of the same order.
+void
+kfree_order(void *pa, int order)
+{
+  int j = (uint64) pa / PGSIZE;
+
+  if(order == 0){
+    kfree(pa);
+    return;
+  }
+  if(((uint64)pa % ((uint64)PGSIZE << order)) != 0 || (char*)pa < end ||
+     (uint64)pa >= PHYSTOP || order > MAXORDER)
+    panic("kfree_order");
+#ifdef POISON
+  memset(pa, 1, (uint64)PGSIZE << order);
+#endif
+
+  acquire(&kmem.lock);
+  if (refcnt[j] != 1) {
+    panic("kfree_order: ref");
+  }
+  refcnt[j] = 0;
+  buddy_free((uint64)pa, order);
+  release(&kmem.lock);
+}
+
+// Print the free blocks of each order, and how fragmented
+// free memory is: the share of it in blocks too small for a
+// megapage. For debugging, from procdump(); no lock.
+void
+kmemdump(void)
+{
+  uint64 free = 0, small = 0, n;
+  int k, top = -1;
+
+  printf("free blocks by order:");
+  for(k = 0; k <= MAXORDER; k++){
+    n = kmem.nfree[k];
+    printf(" %d", (int)n);
+    free += n << k;
+    if(k < MEGAORDER)
+      small += n << k;
+    if(n)
+      top = k;
+  }
+  printf("\nfree pages %d largest order %d unusable for megapages %d%% zeroed %d\n",
+         (int)free, top, free ? (int)(small * 100 / free) : 0, kmem.nzeroed);
+}
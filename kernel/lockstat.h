@@ -0,0 +1,9 @@
+// Contention statistics of the spinlocks with one name, see lockstat().
+struct lockstat {
+  char name[16];
+  int nlocks;        // Locks with this name
+  uint64 nacquire;   // Acquisitions
+  uint64 ncontend;   // Acquisitions that had to wait
+  uint64 nspin;      // Spin iterations spent waiting
+  uint64 maxhold;    // Longest hold, in cycles of r_time()
+};
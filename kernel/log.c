@@ -135,6 +135,8 @@ begin_op(void)
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      // there may be room for the next waiter, too.
+      wakeup_one(&log);
       release(&log.lock);
       break;
     }
@@ -158,8 +160,9 @@ end_op(void)
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+    // the amount of reserved space. each waiter that
+    // gets in wakes the next, see begin_op().
+    wakeup_one(&log);
   }
   release(&log.lock);
 
@@ -169,7 +172,7 @@ end_op(void)
     commit();
     acquire(&log.lock);
     log.committing = 0;
-    wakeup(&log);
+    wakeup_one(&log);
     release(&log.lock);
   }
 }
@@ -1,4 +1,4 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC       512  // maximum number of processes; the table grows to it
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
@@ -11,5 +11,13 @@
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define MAXORDER     10    // largest buddy block, 2^MAXORDER pages
+#define NZEROPAGE    128   // pre-zeroed pages kept for kalloc_zeroed()
 #define NMLFQ        5     // number of MLFQ queues
 #define AGETICKS     64    // number of ticks before aging
+#define TICKINTERVAL 1000000 // cycles per timer tick; about 1/10th second in qemu
+#define TIMEBASE     10000000 // cycles per second of the time CSR in qemu
+#define STRIDE1      (1<<20) // stride of a process holding one ticket
+#define MAXTICKETS   (1<<17) // most tickets a process may hold
+#define CFSLATENCY   (4*TICKINTERVAL) // CFS target latency, cycles
+#define CFSMINGRAN   TICKINTERVAL     // CFS minimum timeslice, cycles
@@ -4,25 +4,41 @@
 #include "riscv.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "sched.h"
 #include "defs.h"
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
+// The process table grows a page of procs at a time, up to
+// NPROC, as fork() runs out of unused ones, and never shrinks,
+// so a proc pointer stays good for good (see findproc()).
+// procs[i] is the proc in slot i, for i < nproc. Unused procs
+// are on a free list, and kernel stacks on a pool of their own.
+#define PROCSPERPAGE (PGSIZE / sizeof(struct proc))
 
-struct proc *initproc;
+struct proc *procs[NPROC];
+int nproc;
+static struct proc *freeprocs;
+static uint64 freestacks;      // Free kernel stacks, linked through their first word
+static int nstack;             // Kernel stacks made so far
+struct spinlock procs_lock;
+
+// The trapframe needs a page of its own, mapped at TRAPFRAME in
+// the user page table, but the copy kept for sigalarm does not.
+static struct kcache *tframecache;
 
-#ifdef MLFQ
-struct queue mlfq[NMLFQ];
-#endif
+struct proc *initproc;
 
 int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void startproc(struct cpu *c, struct proc *p);
+static void finishswitch(void);
 
 extern char trampoline[]; // trampoline.S
+extern pagetable_t kernel_pagetable; // vm.c
 
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
@@ -30,44 +46,138 @@ extern char trampoline[]; // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
-// Allocate a page for each process's kernel stack.
-// Map it high in memory, followed by an invalid
-// guard page.
-void
-proc_mapstacks(pagetable_t kpgtbl)
+// A sleeping process waits on one of NWAITQ queues, chosen
+// by hashing its channel, so wakeup() only looks at processes
+// sleeping on channels that hash alike rather than at every
+// process. A queue's lock must be acquired before any p->lock.
+#define NWAITQ 64
+
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+  struct proc *tail;
+};
+
+static struct waitq waitqs[NWAITQ];
+
+// Processes are found by pid in a hash table, and a parent's
+// children are on a list, so nothing needs to walk proc[]. Both
+// change only with wait_lock held, between treebegin() and
+// treeend(), which make treeseq odd and then even again.
+// Lookups take no locks: they read treeseq before and after,
+// and look again if a change overlapped, like a seqlock. proc
+// structs are never freed, so a stale pointer still points at a
+// proc, and whoever uses what a lookup found must lock it and
+// check that it is still the process it looked for.
+#define NPIDHASH 64
+
+static struct proc *pidhash[NPIDHASH];
+static uint treeseq;
+
+static void
+treebegin(void)
 {
-  struct proc *p;
-  
-  for(p = proc; p < &proc[NPROC]; p++) {
-    char *pa = kalloc();
-    if(pa == 0)
-      panic("kalloc");
-    uint64 va = KSTACK((int) (p - proc));
-    kvmmap(kpgtbl, va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
-  }
+  treeseq++;
+  __sync_synchronize();
+}
+
+static void
+treeend(void)
+{
+  __sync_synchronize();
+  treeseq++;
+}
+
+static uint
+readbegin(void)
+{
+  uint seq;
+
+  while((seq = *(volatile uint*)&treeseq) & 1)
+    ;
+  __sync_synchronize();
+  return seq;
+}
+
+static int
+readretry(uint seq)
+{
+  __sync_synchronize();
+  return *(volatile uint*)&treeseq != seq;
 }
 
 // initialize the proc table.
 void
 procinit(void)
 {
-  struct proc *p;
-  
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
-  for(p = proc; p < &proc[NPROC]; p++) {
-      initlock(&p->lock, "proc");
-      p->state = UNUSED;
-      p->kstack = KSTACK((int) (p - proc));
+  initlock(&procs_lock, "procs");
+  tframecache = kcache_create("tframe", sizeof(struct trapframe));
+  for(int i = 0; i < NWAITQ; i++)
+    initlock(&waitqs[i].lock, "waitq");
+  runqinit();
+}
+
+// Add a page of unused procs to the table, if it may grow.
+// procs_lock must be held.
+static void
+growprocs(void)
+{
+  struct proc *p;
+  int i, n;
+
+  if(nproc == NPROC || (p = (struct proc*)kalloc_zeroed()) == 0)
+    return;
+  n = PROCSPERPAGE;
+  if(n > NPROC - nproc)
+    n = NPROC - nproc;
+  for(i = 0; i < n; i++, p++){
+    initlock(&p->lock, "proc");
+    p->state = UNUSED;
+    p->slot = nproc + i;
+    procs[p->slot] = p;
+    p->free_next = freeprocs;
+    freeprocs = p;
   }
-#ifdef MLFQ
-  for (int i = 0; i < NMLFQ; i++)
-  {
-    mlfq[i].size = 0;
-    mlfq[i].head = 0;
-    mlfq[i].tail = 0;
+  // procdump() reads procs[] without the lock.
+  __sync_synchronize();
+  nproc += n;
+}
+
+// A kernel stack: one from the pool, or a new page mapped high
+// in memory at KSTACK(), over an invalid guard page. Stacks stay
+// mapped when they go back on the pool, so only a new one needs
+// the TLBs flushed. Returns 0 if out of memory. Must be called
+// without any spinlocks, for tlbshootdown().
+static uint64
+kstackalloc(void)
+{
+  uint64 va;
+  char *pa;
+
+  acquire(&procs_lock);
+  if((va = freestacks) != 0){
+    freestacks = *(uint64*)va;
+    release(&procs_lock);
+    return va;
+  }
+  if(nstack == NPROC || (pa = kalloc()) == 0){
+    release(&procs_lock);
+    return 0;
   }
-#endif
+  va = KSTACK(nstack);
+  if(mappages(kernel_pagetable, va, PGSIZE, (uint64)pa, PTE_R | PTE_W) != 0){
+    release(&procs_lock);
+    kfree(pa);
+    return 0;
+  }
+  nstack++;
+  release(&procs_lock);
+  // the process may run on any cpu, and one may
+  // have cached the page as invalid.
+  tlbshootdown();
+  return va;
 }
 
 // Must be called with interrupts disabled,
@@ -122,44 +232,47 @@ static struct proc*
 allocproc(void)
 {
   struct proc *p;
+  uint64 kstack;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
-    }
+  if((kstack = kstackalloc()) == 0)
+    return 0;
+
+  acquire(&procs_lock);
+  if(freeprocs == 0)
+    growprocs();
+  if((p = freeprocs) == 0){
+    *(uint64*)kstack = freestacks;
+    freestacks = kstack;
+    release(&procs_lock);
+    return 0;
   }
-  return 0;
+  freeprocs = p->free_next;
+  p->kstack = kstack;
+  release(&procs_lock);
 
-found:
+  acquire(&p->lock);
   p->pid = allocpid();
 
-  p->ctime = ticks;
+  p->ctime = r_time();
   p->rtime = 0;
   p->stime = 0;
   p->sched_count = 0;
 
-  #ifdef LBS
+  // policy state is set up when p is first queued.
+  p->schedgen = 0;
   p->tickets = 1;
-  #endif
-
-  #ifdef PBS
+  p->affinity = (1 << NCPU) - 1;
+  p->lastcpu = -1;
+  p->migrations = 0;
+  p->held = 0;
+  p->pirank = NORANK;
   p->priority = 60;
-  #endif
-
-  #ifdef MLFQ
-  p->priority = 0;
-  p->in_queue = 0;
-  p->quanta = 1;
-  p->q_in_time = ticks;
+  p->dl_runtime = 0;
+  p->dl_misses = 0;
   for(int i = 0; i < NMLFQ; i++)
   {
     p->qrtime[i] = 0;
   }
-  #endif
-
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -168,7 +281,8 @@ found:
     return 0;
   }
   //Make a trapframe page backup for timer interrupt
-  if((p->bkuptframe = (struct trapframe *)kalloc()) == 0) {
+  if((p->bkuptframe = (struct trapframe *)kcache_alloc(tframecache)) == 0) {
+    freeproc(p);
     release(&p->lock);
     return 0;
   }
@@ -205,7 +319,7 @@ freeproc(struct proc *p)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
   if(p->bkuptframe){
-    kfree((void *)p->bkuptframe);
+    kcache_free(tframecache, p->bkuptframe);
     p->bkuptframe = 0;
   }
   if(p->pagetable)
@@ -224,12 +338,94 @@ freeproc(struct proc *p)
   p->stime = 0;
   p->sched_count = 0;
   p->endtime = 0;
-  #ifdef PBS
   p->priority = 60;
-  #endif
-  #ifdef LBS
   p->tickets = 1;
-  #endif
+
+  // back on the free lists, for allocproc().
+  acquire(&procs_lock);
+  *(uint64*)p->kstack = freestacks;
+  freestacks = p->kstack;
+  p->kstack = 0;
+  p->free_next = freeprocs;
+  freeprocs = p;
+  release(&procs_lock);
+}
+
+// Publish p: make it findable by pid and a child of parent,
+// if any. Caller must hold wait_lock.
+static void
+addproc(struct proc *p, struct proc *parent)
+{
+  struct proc **head = &pidhash[p->pid % NPIDHASH];
+
+  treebegin();
+  p->pid_prev = 0;
+  p->pid_next = *head;
+  if(*head)
+    (*head)->pid_prev = p;
+  *head = p;
+
+  p->parent = parent;
+  p->children = 0;
+  p->sibling_prev = 0;
+  if(parent){
+    p->sibling_next = parent->children;
+    if(parent->children)
+      parent->children->sibling_prev = p;
+    parent->children = p;
+  }
+  treeend();
+}
+
+// Take p off its parent's children. Caller must hold wait_lock
+// and be between treebegin() and treeend().
+static void
+unlinkchild(struct proc *p)
+{
+  if(p->sibling_prev)
+    p->sibling_prev->sibling_next = p->sibling_next;
+  else
+    p->parent->children = p->sibling_next;
+  if(p->sibling_next)
+    p->sibling_next->sibling_prev = p->sibling_prev;
+}
+
+// Undo addproc(), for a reaped child.
+// Caller must hold wait_lock.
+static void
+dropproc(struct proc *p)
+{
+  treebegin();
+  if(p->pid_prev)
+    p->pid_prev->pid_next = p->pid_next;
+  else
+    pidhash[p->pid % NPIDHASH] = p->pid_next;
+  if(p->pid_next)
+    p->pid_next->pid_prev = p->pid_prev;
+  unlinkchild(p);
+  treeend();
+}
+
+// The process with the given pid, or 0. Takes no locks, so the
+// process may exit or be reaped at any moment: lock it and check
+// its pid before use.
+struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+  uint seq;
+  int n;
+
+  do {
+    seq = readbegin();
+    // a change under way can leave a chain briefly looping.
+    for(p = pidhash[pid % NPIDHASH], n = 0; p && n < NPROC; p = p->pid_next, n++)
+      if(p->pid == pid)
+        break;
+  } while(readretry(seq));
+  if(p && p->pid != pid)
+    p = 0;
+  return p;
 }
 
 // Create a user page table for a given process, with no user memory,
@@ -310,9 +506,13 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&p->lock);
+
+  acquire(&wait_lock);
+  addproc(p, 0);
+  release(&wait_lock);
 }
 
 // Grow or shrink user memory by n bytes.
@@ -376,14 +576,13 @@ fork(void)
   release(&np->lock);
 
   acquire(&wait_lock);
-  np->parent = p;
+  addproc(np, p);
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
-  #ifdef LBS
   np->tickets = p->tickets;
-  #endif
+  np->affinity = p->affinity;
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
@@ -396,12 +595,20 @@ reparent(struct proc *p)
 {
   struct proc *pp;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    if(pp->parent == p){
-      pp->parent = initproc;
-      wakeup(initproc);
-    }
+  if(p->children == 0)
+    return;
+  treebegin();
+  while((pp = p->children) != 0){
+    unlinkchild(pp);
+    pp->parent = initproc;
+    pp->sibling_prev = 0;
+    pp->sibling_next = initproc->children;
+    if(initproc->children)
+      initproc->children->sibling_prev = pp;
+    initproc->children = pp;
   }
+  treeend();
+  wakeup(initproc);
 }
 
 // Exit the current process.  Does not return.
@@ -415,6 +622,9 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // give back p's deadline reservation.
+  setdeadline(0, 0, 0);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -441,7 +651,7 @@ exit(int status)
 
   p->xstate = status;
   p->state = ZOMBIE;
-  p->endtime = ticks;
+  p->endtime = r_time();
 
   release(&wait_lock);
 
@@ -462,30 +672,29 @@ wait(uint64 addr)
   acquire(&wait_lock);
 
   for(;;){
-    // Scan through table looking for exited children.
+    // Scan through our children looking for exited ones.
     havekids = 0;
-    for(pp = proc; pp < &proc[NPROC]; pp++){
-      if(pp->parent == p){
-        // make sure the child isn't still in exit() or swtch().
-        acquire(&pp->lock);
-
-        havekids = 1;
-        if(pp->state == ZOMBIE){
-          // Found one.
-          pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
-            return -1;
-          }
-          freeproc(pp);
+    for(pp = p->children; pp; pp = pp->sibling_next){
+      // make sure the child isn't still in exit() or swtch().
+      acquire(&pp->lock);
+
+      havekids = 1;
+      if(pp->state == ZOMBIE){
+        // Found one.
+        pid = pp->pid;
+        if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
+                                sizeof(pp->xstate)) < 0) {
           release(&pp->lock);
           release(&wait_lock);
-          return pid;
+          return -1;
         }
+        dropproc(pp);
+        freeproc(pp);
         release(&pp->lock);
+        release(&wait_lock);
+        return pid;
       }
+      release(&pp->lock);
     }
 
     // No point waiting if we don't have any children.
@@ -511,32 +720,32 @@ waitx(uint64 addr, uint* rtime, uint* wtime)
   acquire(&wait_lock);
 
   for(;;){
-    // Scan through table looking for exited children.
+    // Scan through our children looking for exited ones.
     havekids = 0;
-    for(np = proc; np < &proc[NPROC]; np++){
-      if(np->parent == p){
-        // make sure the child isn't still in exit() or swtch().
-        acquire(&np->lock);
-
-        havekids = 1;
-        if(np->state == ZOMBIE){
-          // Found one.
-          pid = np->pid;
-          *rtime = np->rtime;
-          *wtime = np->endtime - np->ctime - np->rtime;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
-                                  sizeof(np->xstate)) < 0) {
-            release(&np->lock);
-            release(&wait_lock);
-            return -1;
-          }
-          freeproc(np);
+    for(np = p->children; np; np = np->sibling_next){
+      // make sure the child isn't still in exit() or swtch().
+      acquire(&np->lock);
+
+      havekids = 1;
+      if(np->state == ZOMBIE){
+        // Found one.
+        pid = np->pid;
+        // in ticks, rounded from the exact cycle counts.
+        *rtime = (np->rtime + TICKINTERVAL/2) / TICKINTERVAL;
+        *wtime = (np->endtime - np->ctime - np->rtime + TICKINTERVAL/2) / TICKINTERVAL;
+        if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
+                                sizeof(np->xstate)) < 0) {
           release(&np->lock);
           release(&wait_lock);
-          return pid;
+          return -1;
         }
+        dropproc(np);
+        freeproc(np);
         release(&np->lock);
+        release(&wait_lock);
+        return pid;
       }
+      release(&np->lock);
     }
 
     // No point waiting if we don't have any children.
@@ -550,424 +759,132 @@ waitx(uint64 addr, uint* rtime, uint* wtime)
   }
 }
 
-#ifdef ROUND_ROBIN
-void
-round_robin(struct cpu *c) {
-  for(struct proc *p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        p->sched_count++;
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
-    }
-}
-#endif
-
-#ifdef FCFS
-void
-fcfs(struct cpu *c) {
-  int minimum_time = 0;
-  struct proc *proc_with_min_time = 0;
-
-  // go through all processes and find the one with the minimum creation time
-  for(struct proc *p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == RUNNABLE) {
-      // if there is no current process, or the process p has a greater creation time than the current process,
-      // then we set the current minimum process to the process p
-      if(proc_with_min_time == 0 || p->ctime < minimum_time) {
-        if(proc_with_min_time!= 0) {
-          release(&proc_with_min_time->lock); // release the lock of the previous minimum process so that new process can acquire it
-        }
-        proc_with_min_time = p;
-      }
-    }
-    // if current process is not the same as the minimum process, then release the lock of the current process
-    if(proc_with_min_time != p) {
-      release(&p->lock);
-    }
-  }
-
-  if(proc_with_min_time != 0) {
-    proc_with_min_time->sched_count++;
-    //Switch to chosen process.  It is the process's job
-    // to release its lock and then reacquire it
-    // before jumping back to us.
-    proc_with_min_time->state = RUNNING;
-    c->proc = proc_with_min_time;
-    swtch(&c->context, &proc_with_min_time->context);
-
-    // Process is done running for now.
-    // It should have changed its p->state before coming back.
-    c->proc = 0;
-    // release the lock once process is done running
-    release(&proc_with_min_time->lock);
-  }
-}
-#endif
-
-#ifdef LBS
-
-void settickets(int tickets)
-{
-  struct proc *p = myproc();
-  acquire(&p->lock);
-  p->tickets = tickets;
-  release(&p->lock);
-}
-
-// from FreeBSD.
-int
-do_rand(unsigned long *ctx)
-{
-/*
- * Compute x = (7^5 * x) mod (2^31 - 1)
- * without overflowing 31 bits:
- *      (2^31 - 1) = 127773 * (7^5) + 2836
- * From "Random number generators: good ones are hard to find",
- * Park and Miller, Communications of the ACM, vol. 31, no. 10,
- * October 1988, p. 1195.
- */
-    long hi, lo, x;
-
-    /* Transform to [1, 0x7ffffffe] range. */
-    x = (*ctx % 0x7ffffffe) + 1;
-    hi = x / 127773;
-    lo = x % 127773;
-    x = 16807 * lo - 2836 * hi;
-    if (x < 0)
-        x += 0x7fffffff;
-    /* Transform to [0, 0x7ffffffd] range. */
-    x--;
-    *ctx = x;
-    return (x);
-}
-
-unsigned long rand_next = 1;
-
-int
-rand(void)
-{
-    return (do_rand(&rand_next));
-}
-
-int
-get_random_ticket(int a, int b)
-{
-    if(a > b) {
-        int temp = a;
-        a = b;
-        b = temp;
-    }
-
-    int range = b - a + 1;
-    int r = rand() % range;
-    return (a + r);
-}
-
-void
-lbs(struct cpu *c)
-{
-  int total_tickets = 0;
-  struct proc *lucky_proc = 0;
-
-  for(struct proc *p = proc; p < &proc[NPROC]; p++)
-  {
-    acquire(&p->lock);
-    if(p->state == RUNNABLE)
-    {
-      total_tickets += p->tickets;
-    }
-    release(&p->lock);
-  }
-
-  int lucky_ticket = get_random_ticket(0, total_tickets);
-
-  total_tickets = 0;
-
-  for(struct proc *p = proc; p < &proc[NPROC]; p++)
-  {
-    acquire(&p->lock);
-    if(p->state == RUNNABLE)
-    {
-      total_tickets += p->tickets;
-      if(total_tickets >= lucky_ticket)
-      {
-        lucky_proc = p;
-        break;
-      }
-    }
-    release(&p->lock);
-  }
-
-  if(lucky_proc != 0)
-  {
-    lucky_proc->sched_count++;
-    lucky_proc->state = RUNNING;
-    c->proc = lucky_proc;
-    swtch(&c->context, &lucky_proc->context);
-    c->proc = 0;
-    release(&lucky_proc->lock);
-  }
-}
-
-
-#endif
-
-#ifdef PBS
-void set_priority(int priority, int pid, int* old_priority)
-{
-  for(struct proc *p = proc; p < &proc[NPROC]; p++) {
-    if(p->pid == pid) {
-      acquire(&p->lock);
-      *old_priority = p->priority;
-      p->priority = priority;
-      p->rtime = 0;
-      p->stime = 0;
-      release(&p->lock);
-      if(*old_priority > priority) {
-        yield();
-      }
-    }
-  }
-}
-
-int dynamic_priority(struct proc *p)
-{
-  int niceness;
-  int dp;
-
-  if(p->rtime + p->stime != 0)
-    niceness = (p->stime / (p->rtime + p->stime)) * 10;
-  else
-  {
-    niceness = 5;
-  }
-
-  dp = p->priority - niceness + 5;
-
-  if(dp > 100)
-  {
-    dp = 100;
-  }
-  return dp;
-}
-
-void
-pbs(struct cpu *c)
-{
-  struct proc *minproc = 0;
-  for(struct proc *p = proc; p < &proc[NPROC]; p++)
-  {
-    acquire(&p->lock);
-    if(p->state == RUNNABLE)
-    {
-      if(minproc == 0)
-      {
-        minproc = p;
-        continue;
-      }
-
-      if(dynamic_priority(minproc) > dynamic_priority(p))
-      {
-        release(&minproc->lock);
-        minproc = p;
-        continue;
-      }
-
-      if(dynamic_priority(minproc) == dynamic_priority(p))
-      {
-        if(minproc->sched_count > p->sched_count)
-        {
-          release(&minproc->lock);
-          minproc = p;
-          continue;
-        }
-        else if(minproc->sched_count == p->sched_count)
-        {
-          if(minproc->ctime > p->ctime)
-          {
-            release(&minproc->lock);
-            minproc = p;
-            continue;
-          }
-        }
-      }
-    }
-    release(&p->lock);
-  }
-
-  if(minproc != 0)
-  {
-    minproc->sched_count++;
-    minproc->state = RUNNING;
-    minproc->rtime = 0;
-    minproc->stime = 0;
-    c->proc = minproc;
-    swtch(&c->context, &minproc->context);
-    c->proc = 0;
-    release(&minproc->lock);
-  }
-}
-#endif
-
-#ifdef MLFQ
-void
-mlfq_sched(struct cpu *c)
-{
-  struct proc *minproc = 0;
-  // reset priority of old procs
-  for(struct proc *p = proc; p < &proc[NPROC];p++ )
-  {
-    if(p->state != RUNNABLE)
-    {
-      continue;
-    }
-
-    if(ticks - p->q_in_time >= AGETICKS)
-    {
-      p->q_in_time = ticks;
-      if(p->in_queue)
-      {
-        queue_remove(&mlfq[p->priority], p->pid);
-        p->in_queue = 0;
-      }
-
-      if(p->priority > 0) p->priority--;
-    }
-  }
-
-  for(struct proc *p = proc; p < &proc[NPROC]; p++)
-  {
-    acquire(&p->lock);
-    if(p->state == RUNNABLE && !p->in_queue)
-    {
-      queue_push(&mlfq[p->priority], p);
-      p->in_queue = 1;
-    }
-    release(&p->lock);
-  }
-
-  for(int i = 0; i < NMLFQ; i++)
-  {
-    while(mlfq[i].size)
-    {
-      struct proc *p = top(&mlfq[i]);
-      acquire(&p->lock);
-      queue_pop(&mlfq[i]);
-      p->in_queue = 0;
-
-      if(p->state == RUNNABLE)
-      {
-        p->q_in_time = ticks;
-        minproc = p;
-        break;
-      }
-      release(&p->lock);
-    }
-    if(minproc != 0)
-    {
-      break;
-    }
-  }
-
-  if(minproc != 0)
-  {
-    minproc->quanta = 1 << minproc->priority;
-    minproc->sched_count++;
-    minproc->state = RUNNING;
-    c->proc = minproc;
-    swtch(&c->context, &minproc->context);
-    c->proc = 0;
-    minproc->q_in_time = ticks;
-    release(&minproc->lock);
-  }
-}
-#endif
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - choose a process to run from this cpu's run queue,
+//    or steal one from another cpu's (see sched.c).
 //  - swtch to start running that process.
-//  - eventually that process transfers control
+//  - eventually that process, or another it switched
+//    to directly (see sched()), transfers control
 //    via swtch back to the scheduler.
 void
 scheduler(void)
 {
+  struct proc *p;
   struct cpu *c = mycpu();
   
   c->proc = 0;
+  c->online = 1;
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    #ifdef ROUND_ROBIN
-    round_robin(c);
-    #endif
+    // whatever asked for a reschedule is about to get one.
+    c->resched = 0;
 
-    #ifdef FCFS
-    fcfs(c);
-    #endif
+    if((p = runq_pick(c)) == 0){
+      runq_idle(c);
+      continue;
+    }
 
-    #ifdef LBS
-    lbs(c);
-    #endif
+    acquire(&p->lock);
+    if(p->state == RUNNABLE && runq_allowed(c, p)) {
+      // Switch to chosen process.  It is the process's job
+      // to release its lock and then reacquire it
+      // before jumping back to us.
+      startproc(c, p);
+      swtch(&c->context, &p->context);
+
+      // Process is done running for now.
+      // It should have changed its p->state before coming back.
+      // It need not be the one we switched to, if that one
+      // switched directly to others; we hold its lock.
+      p = c->proc;
+      c->proc = 0;
+    }
+    release(&p->lock);
+  }
+}
 
-    #ifdef PBS
-    pbs(c);
-    #endif
+// Make p, just taken off a run queue and locked,
+// the process running on c.
+static void
+startproc(struct cpu *c, struct proc *p)
+{
+  p->sched_count++;
+  if(p->lastcpu >= 0 && p->lastcpu != c - cpus)
+    p->migrations++;
+  p->lastcpu = c - cpus;
+  runq_start(p);
+  p->qstart = p->tstamp = r_time();
+  p->state = RUNNING;
+  c->proc = p;
+  timerupdate();
+}
 
-    #ifdef MLFQ
-    mlfq_sched(c);
-    #endif
-  }
+// Called on the new process's side of a direct switch, once
+// we're off the previous process's stack: queue it again if
+// it is still RUNNABLE and sched() hasn't already, and release
+// its lock, which sched() held across the switch so no other
+// cpu could run it.
+static void
+finishswitch(void)
+{
+  struct cpu *c = mycpu();
+  struct proc *prev = c->prev;
+
+  if(prev == 0)
+    return;
+  c->prev = 0;
+  if(!c->prevqueued)
+    runq_putprev(prev);
+  release(&prev->lock);
 }
 
+// Charge p, running on this cpu, for the cycles since
+// p->tstamp, and this cpu for them too. Only the cpu p runs on
+// charges it, so this needs no lock; it's done as p stops
+// running and on each tick, rather than by walking the process
+// table. A sleeper is charged as it wakes, see setrunnable().
 void
-update_time()
+chargetime(struct proc *p)
 {
-  struct proc *p;
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    switch(p->state){
-      case RUNNING:
-        p->rtime++;
-        #ifdef MLFQ
-          p->qrtime[p->priority]++;
-          p->quanta--;
-        #endif
-      break;
-      case SLEEPING:
-        p->stime++;
-      break;
-      default:
-      break;
-    }
-    release(&p->lock);
-  }
+  uint64 now = r_time();
+  uint64 d = now - p->tstamp;
+
+  p->tstamp = now;
+  p->rtime += d;
+  p->qrtime[p->level] += d;
+  mycpu()->busytime += d;
 }
-// Switch to scheduler.  Must hold only p->lock
+
+// Switch to the next process queued for this cpu, or if
+// there is none to the scheduler.  Must hold only p->lock
 // and have changed proc->state. Saves and restores
 // intena because intena is a property of this
 // kernel thread, not this CPU. It should
 // be proc->intena and proc->noff, but that would
 // break in the few places where a lock is held but
 // there's no process.
+//
+// Switching directly saves going through the scheduler
+// thread, and its second swtch, on every yield and block.
+// A yielding p that would go back on this cpu's queue anyway
+// is queued before the pick, so the policy weighs it against
+// the others and may choose it again, in which case p just
+// carries on. Other cpus leave p alone on the queue until it
+// stops being this cpu's current process, see runq_takefor();
+// and p is queued anywhere else only after the switch, by the
+// next process (finishswitch()). Either way no other cpu can
+// be holding the next process's lock while waiting for p's.
 void
 sched(void)
 {
-  int intena;
+  int intena, queued;
   struct proc *p = myproc();
+  struct cpu *c = mycpu();
+  struct proc *q;
 
   if(!holding(&p->lock))
     panic("sched p->lock");
@@ -978,8 +895,39 @@ sched(void)
   if(intr_get())
     panic("sched interruptible");
 
-  intena = mycpu()->intena;
-  swtch(&p->context, &mycpu()->context);
+  chargetime(p);
+  intena = c->intena;
+
+  queued = runq_requeue(p);
+  c->resched = 0;
+  if((q = runq_pick(c)) == p){
+    // chosen again: no switch.
+    startproc(c, p);
+    mycpu()->intena = intena;
+    return;
+  }
+  if(q != 0){
+    acquire(&q->lock);
+    if(q->state == RUNNABLE && runq_allowed(c, q)){
+      c->prev = p;
+      c->prevqueued = queued;
+      startproc(c, q);
+      swtch(&p->context, &q->context);
+    } else {
+      release(&q->lock);
+      q = 0;
+    }
+  }
+  if(q == 0){
+    // the scheduler thread releases p's lock, and picks
+    // it from this cpu's queue if it was queued.
+    if(!queued)
+      runq_putprev(p);
+    swtch(&p->context, &c->context);
+  }
+
+  // running again, perhaps switched to directly.
+  finishswitch();
   mycpu()->intena = intena;
 }
 
@@ -995,13 +943,15 @@ yield(void)
 }
 
 // A fork child's very first scheduling by scheduler()
-// will swtch to forkret.
+// or sched() will swtch to forkret.
 void
 forkret(void)
 {
   static int first = 1;
 
-  // Still holding p->lock from scheduler.
+  // Still holding p->lock from scheduler, and the previous
+  // process's if sched() switched here directly.
+  finishswitch();
   release(&myproc()->lock);
 
   if (first) {
@@ -1015,53 +965,134 @@ forkret(void)
   usertrapret();
 }
 
+static struct waitq*
+waitq_of(void *chan)
+{
+  uint64 h = (uint64)chan;
+
+  return &waitqs[((h >> 3) ^ (h >> 9)) % NWAITQ];
+}
+
+// Append p to wq.
+// wq->lock must be held.
+static void
+waitq_push(struct waitq *wq, struct proc *p)
+{
+  p->wq = wq;
+  p->wq_next = 0;
+  p->wq_prev = wq->tail;
+  if(wq->tail)
+    wq->tail->wq_next = p;
+  else
+    wq->head = p;
+  wq->tail = p;
+}
+
+// Unlink p from wq.
+// wq->lock must be held.
+static void
+waitq_remove(struct waitq *wq, struct proc *p)
+{
+  if(p->wq_prev)
+    p->wq_prev->wq_next = p->wq_next;
+  else
+    wq->head = p->wq_next;
+  if(p->wq_next)
+    p->wq_next->wq_prev = p->wq_prev;
+  else
+    wq->tail = p->wq_prev;
+  p->wq = 0;
+  p->wq_next = 0;
+  p->wq_prev = 0;
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *wq = waitq_of(chan);
   
-  // Must acquire p->lock in order to
-  // change p->state and then call sched.
-  // Once we hold p->lock, we can be
-  // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // Must acquire wq->lock to join chan's wait queue, and
+  // p->lock in order to change p->state and then call sched.
+  // Once we hold wq->lock, we can be guaranteed that we
+  // won't miss any wakeup (wakeup locks wq->lock),
   // so it's okay to release lk.
 
+  acquire(&wq->lock);
   acquire(&p->lock);  //DOC: sleeplock1
   release(lk);
 
   // Go to sleep.
+  waitq_push(wq, p);
   p->chan = chan;
   p->state = SLEEPING;
+  release(&wq->lock);
 
   sched();
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+
+  // wakeup() took p off the queue, unless
+  // it was kill() that woke p.
+  acquire(&wq->lock);
+  if(p->wq == wq)
+    waitq_remove(wq, p);
+  release(&wq->lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
+// Wake up processes sleeping on chan, in the order
+// they went to sleep: all of them, or only the first
+// if one is set.
+static void
+wakeup_chan(void *chan, int one)
+{
+  struct waitq *wq = waitq_of(chan);
+  struct proc *p, *next;
+
+  acquire(&wq->lock);
+  for(p = wq->head; p; p = next){
+    next = p->wq_next;
+    if(p->chan != chan)
+      continue;
+    acquire(&p->lock);
+    if(p->state == SLEEPING && p->chan == chan) {
+      waitq_remove(wq, p);
+      setrunnable(p);
+      release(&p->lock);
+      if(one)
+        break;
+      continue;
+    }
+    release(&p->lock);
+  }
+  release(&wq->lock);
+}
+
 // Wake up all processes sleeping on chan.
 // Must be called without any p->lock.
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  wakeup_chan(chan, 0);
+}
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
-      acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-    }
-  }
+// Wake up the process that has slept longest on chan.
+// For channels where whoever wakes up consumes what it
+// was waiting for, so the others would only go back to
+// sleep; the one woken must pass the wakeup on if it
+// leaves something for the next.
+// Must be called without any p->lock.
+void
+wakeup_one(void *chan)
+{
+  wakeup_chan(chan, 1);
 }
 
 // Kill the process with the given pid.
@@ -1072,20 +1103,21 @@ kill(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
+  if((p = findproc(pid)) == 0)
+    return -1;
+  acquire(&p->lock);
+  if(p->pid != pid){
+    // reaped since findproc().
     release(&p->lock);
+    return -1;
   }
-  return -1;
+  p->killed = 1;
+  if(p->state == SLEEPING){
+    // Wake process from sleep().
+    setrunnable(p);
+  }
+  release(&p->lock);
+  return 0;
 }
 
 void
@@ -1137,8 +1169,16 @@ either_copyin(void *dst, int user_src, uint64 src, uint64 len)
   }
 }
 
+// Cycles of the time CSR in milliseconds, for procdump().
+static int
+ms(uint64 cycles)
+{
+  return cycles / (TIMEBASE / 1000);
+}
+
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
+// Times are in milliseconds.
 // No lock to avoid wedging a stuck machine further.
 void
 procdump(void)
@@ -1152,101 +1192,74 @@ procdump(void)
   [ZOMBIE]    "zombie"
   };
   struct proc *p;
+  struct cpu *c;
   char *state;
+  int i;
 
   printf("\n");
-  #ifdef ROUND_ROBIN
-  printf("PID State Name\n");
-  #endif
-  #ifdef FCFS
+  switch(getsched()){
+  case SCHED_RR:
+    printf("PID State Name\n");
+    break;
+  case SCHED_FCFS:
     printf("PID State Name ctime\n");
-  #endif
-  #ifdef PBS
+    break;
+  case SCHED_LBS:
+    printf("PID State Name tickets\n");
+    break;
+  case SCHED_PBS:
     printf("PID Priority State Name rtime stime sched_count\n");
-  #endif
-  #ifdef MLFQ
+    break;
+  case SCHED_MLFQ:
     printf("PID Priority State rtime stime sched_count q0 q1 q2 q3 q4\n");
-  #endif
-  for(p = proc; p < &proc[NPROC]; p++){
+    break;
+  case SCHED_STRIDE:
+    printf("PID State Name tickets pass\n");
+    break;
+  case SCHED_CFS:
+    printf("PID State Name tickets vruntime\n");
+    break;
+  }
+  for(i = 0; i < nproc; i++){
+    p = procs[i];
     if(p->state == UNUSED)
       continue;
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
       state = states[p->state];
     else
       state = "???";
-    #ifdef ROUND_ROBIN
-    printf("%d %s %s", p->pid, state, p->name);
-    #endif
-    #ifdef FCFS
-    printf("%d %s %s %d", p->pid, state, p->name, p->ctime);
-    #endif
-    #ifdef LBS
-    printf("%d %s %s %d", p->pid, state, p->name, p->tickets);
-    #endif
-    #ifdef PBS
-    printf("%d %d %s %s %d %d %d", p->pid, dynamic_priority(p), state, p->name, p->rtime, p->stime, p->sched_count);
-    #endif
-    #ifdef MLFQ
-    printf("%d %d %s %d %d %d %d %d %d %d %d", p->pid, p->priority, state, p->rtime, p->stime, p->sched_count, p->qrtime[0], p->qrtime[1], p->qrtime[2], p->qrtime[3], p->qrtime[4]);
-    #endif
-    printf("\n");
-  }
-}
-
-// queue functions
-#ifdef MLFQ
-struct proc *top(struct queue *q) {
-  if(q->size == 0) {
-    return 0;
-  }
-  return q->procs[q->head];
-}
-
-void queue_push(struct queue *q, struct proc *p) {
-  if(q->size == NPROC) {
-    panic("queue is full");
-  }
-  q->procs[q->tail] = p;
-  q->tail = (q->tail + 1) % NPROC;
-  q->size++;
-}
-
-void queue_pop(struct queue *q) {
-  if(q->size == 0) {
-    panic("queue is empty");
-  }
-  q->head = (q->head + 1) % NPROC;
-  q->size--;
-}
-
-void queue_remove(struct queue* q, int pid)
-{
-  for(int curr = q->head; curr != q->tail; curr = (curr+1) % NPROC)
-  {
-    if(q->procs[curr]->pid == pid)
-    {
-      struct proc *temp = q->procs[curr];
-      q->procs[curr] = q->procs[(curr+1) % NPROC];
-      q->procs[(curr+1) % NPROC] = temp;
+    switch(getsched()){
+    case SCHED_RR:
+      printf("%d %s %s", p->pid, state, p->name);
+      break;
+    case SCHED_FCFS:
+      printf("%d %s %s %d", p->pid, state, p->name, ms(p->ctime));
+      break;
+    case SCHED_LBS:
+      printf("%d %s %s %d", p->pid, state, p->name, p->tickets);
+      break;
+    case SCHED_STRIDE:
+      printf("%d %s %s %d %p", p->pid, state, p->name, p->tickets, p->pass);
+      break;
+    case SCHED_CFS:
+      printf("%d %s %s %d %d", p->pid, state, p->name, p->tickets, ms(p->vruntime));
+      break;
+    case SCHED_PBS:
+      printf("%d %d %s %s %d %d %d", p->pid, dynamic_priority(p), state, p->name, ms(p->rtime), ms(p->stime), p->sched_count);
+      break;
+    case SCHED_MLFQ:
+      printf("%d %d %s %d %d %d %d %d %d %d %d", p->pid, p->level, state, ms(p->rtime), ms(p->stime), p->sched_count, ms(p->qrtime[0]), ms(p->qrtime[1]), ms(p->qrtime[2]), ms(p->qrtime[3]), ms(p->qrtime[4]));
+      break;
     }
+    if(p->dl_runtime)
+      printf(" dl %d/%d/%d misses %d", p->dl_runtime, p->dl_period, p->dl_deadline, p->dl_misses);
+    printf(" cpu %d migrations %d", p->lastcpu, p->migrations);
+    printf("\n");
   }
-
-  q->tail--;
-  q->size--;
-
-  if(q->tail < 0)
-  {
-    q->tail = NPROC - 1;
-  }
-}
-#endif
-
-
-#ifdef MLFQ
-void
-printstats()
-{
-  struct proc *p = myproc();
-  printf("pid: %d--->priority: %d\n", p->pid, p->priority);
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    if(c->online)
+      printf("cpu %d busy %d idle %d\n", (int)(c - cpus), ms(c->busytime), ms(c->idletime));
+  printf("priority inversions %d\n", pi_inversions);
+  kcachedump();
+  kmemdump();
 }
-#endif
\ No newline at end of file
@@ -18,16 +18,87 @@ struct context {
   uint64 s11;
 };
 
+// Binary min-heap of processes ordered by before(), see sched.c.
+struct pheap {
+  int n;                      // Number of processes in the heap
+  struct proc *procs[NPROC];
+  int (*before)(struct proc*, struct proc*);
+};
+
+// Per-CPU queue of RUNNABLE processes, see sched.c.
+struct runq {
+  struct spinlock lock;
+  struct cpu *cpu;            // Cpu this queue belongs to
+  int nrunnable;              // Number of processes on the queue
+  struct proc *head;          // Oldest runnable process
+  struct proc *tail;          // Newest runnable process
+  // Deadline class
+  struct pheap dl;            // Queued deadline processes by deadline
+  struct proc *dlthrottled;   // Deadline processes waiting for their period
+  long dlbw;                  // Bandwidth admitted to this cpu, dllock
+  // MLFQ
+  uint levels;                // Bit i is set if level i is non-empty
+  struct proc *qhead[NMLFQ];  // First process of each level
+  struct proc *qtail[NMLFQ];  // Last process of each level
+  // LBS
+  int tickets[NPROC+1];       // Fenwick tree of tickets by proc slot
+  int totaltickets;           // Tickets of all queued processes
+  unsigned long seed;         // State of this cpu's random numbers
+  // STRIDE, PBS, CFS
+  struct pheap heap;          // Queued processes in policy order
+  // STRIDE
+  uint64 gpass;               // Pass of the last process picked
+  // CFS
+  uint64 min_vruntime;        // Monotonic floor of queued vruntimes
+  uint64 load;                // Sum of queued processes' tickets
+};
+
 // Per-CPU state.
 struct cpu {
   struct proc *proc;          // The process running on this cpu, or null.
+  struct proc *prev;          // Process sched() switched away from directly, still locked
+  int prevqueued;             // Was prev already queued again by sched()?
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  int online;                 // Has this cpu entered scheduler()?
+  int resched;                // Should the running process yield?
+  int idle;                   // Is this cpu waiting for work in wfi?
+  int tickless;               // Has this cpu stopped its periodic tick?
+  int ipi;                    // IPI_* reasons sent to this cpu, not yet handled
+  uint tlbreq;                // TLB flushes asked of this cpu, see tlbshootdown()
+  uint tlbdone;               // Value of tlbreq at this cpu's last flush
+  uint64 nexttick;            // r_time() of the next tick, unless tickless
+  uint64 busytime;            // Cycles spent running processes
+  uint64 idletime;            // Cycles spent waiting in wfi
+  struct runq rq;             // Processes waiting to run on this cpu.
 };
 
 extern struct cpu cpus[NCPU];
 
+// Reasons for an IPI, see sendipi().
+#define IPI_KICK      1   // Work was queued; leave wfi, restart the tick
+#define IPI_RESCHED   2   // c->resched is set
+#define IPI_TLB       4   // Flush the TLB
+
+#define NORANK 0x7fffffff   // No rank lent, see "Priority inheritance" in sched.c
+
+// A scheduling policy, see sched.c. Hooks that take a run queue
+// are called with its lock held; a null hook does nothing.
+struct policy {
+  char *name;
+  void (*init)(struct runq*);                   // Set up an empty queue
+  void (*reset)(struct proc*);                  // Start p afresh under this policy
+  void (*enqueue)(struct runq*, struct proc*);  // p joins the queue
+  void (*dequeue)(struct runq*, struct proc*);  // p leaves the queue
+  struct proc *(*pick_next)(struct runq*);      // Queued process to run next
+  void (*start)(struct proc*);                  // p is about to run; p->lock held
+  void (*putprev)(struct runq*, struct proc*, uint64); // p ran for that many cycles
+  void (*tick)(struct cpu*);                    // Timer interrupt on this cpu
+  int (*preempt)(struct cpu*, struct proc*);    // Should p, just queued, run instead of c->proc?
+  int (*rank)(struct proc*);                    // p's priority, lower is better, for inheritance
+};
+
 // per-process data for the trap handling code in trampoline.S.
 // sits in a page by itself just under the trampoline page in the
 // user page table. not specially mapped in the kernel page table.
@@ -92,11 +163,32 @@ struct proc {
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
 
-  // wait_lock must be held when using this:
+  // wait_lock must be held when changing these; see findproc()
+  // for reading them without it:
   struct proc *parent;         // Parent process
+  struct proc *children;       // Most recent child
+  struct proc *sibling_next;   // Next child of parent
+  struct proc *sibling_prev;   // Previous child of parent
+  struct proc *pid_next;       // Next process in pid's hash chain
+  struct proc *pid_prev;       // Previous process in pid's hash chain
+
+  // wq->lock must be held when using these:
+  struct waitq *wq;            // Wait queue p sleeps on, or null
+  struct proc *wq_next;        // Next process on the wait queue
+  struct proc *wq_prev;        // Previous process on the wait queue
+
+  // rq->lock must be held when using these:
+  struct runq *rq;             // Run queue p is on, or null
+  struct proc *rq_next;        // Next process on the run queue
+  struct proc *rq_prev;        // Previous process on the run queue
+  int heapidx;                 // Index in the run queue's heap
+
+  // procs_lock must be held when using these:
+  int slot;                    // Index in procs[], fixed
+  struct proc *free_next;      // Next unused process
+  uint64 kstack;               // Virtual address of kernel stack, see kstackalloc()
 
   // these are private to the process, so p->lock need not be held.
-  uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
   struct trapframe *trapframe; // data page for trampoline.S
@@ -110,40 +202,61 @@ struct proc {
   uint64 hndlr;                // Alarm handler
   int handling;                // Checking if timer interrupt is being handled
   struct trapframe* bkuptframe; // Backup trapframe
-  uint64 ctime;                  // Creation time
-  uint64 rtime;                  // Running time
-  uint64 stime;                  // Sleeping time
-  uint64 endtime;               // End time
+  uint64 ctime;                  // Creation time, r_time()
+  uint64 rtime;                  // Running time, cycles
+  uint64 stime;                  // Sleeping time, cycles
+  uint64 endtime;               // Exit time, r_time()
   int sched_count;              // Number of times scheduled
+  uint64 qstart;                // time when p was last scheduled
+  uint64 tstamp;                // r_time() up to which rtime or stime is charged
 
-  #ifdef LBS
-  int tickets;                  // Number of tickets
-  #endif
+  int schedgen;                 // Policy generation p's state below is for, rq->lock
 
-  #ifdef PBS
-  int priority;                 // Priority of process
-  #endif
+  int tickets;                  // Number of tickets (LBS, STRIDE, CFS)
+
+  // Placement, set with p->lock held
+  int affinity;                 // Cpus p may run on, bit i for cpu i
+  int lastcpu;                  // Cpu p last ran on, or -1
+  int migrations;               // Times p has run on a different cpu than the last
+
+  // Priority inheritance, see sched.c
+  struct sleeplock *held;       // Sleeplocks p holds, private to p
+  int pirank;                   // Best rank lent by their waiters, p->lock
+
+  // Deadline class, p->lock; runtime 0 if not in it
+  int dl_runtime;               // Ticks of cpu guaranteed per period
+  int dl_deadline;              // Relative deadline, in ticks
+  int dl_period;                // Period, in ticks
+  int dl_cpu;                   // Cpu p was admitted to
+  long dl_bw;                   // Bandwidth reserved on dl_cpu
+  int dl_budget;                // Ticks left in this period
+  uint dl_abs;                  // Absolute deadline of this period
+  uint dl_next;                 // Start of the next period
+  int dl_missed;                // Has this period's deadline been missed?
+  int dl_misses;                // Number of deadlines missed
+
+  // LBS
+  int comptickets;              // Compensation for blocking early
+  int qtickets;                 // Tickets counted in p->rq, rq->lock
+
+  // STRIDE
+  uint64 pass;                  // Virtual time of next quantum
+  long remain;                  // pass - rq->gpass when p last left
 
-  #ifdef MLFQ
+  // CFS
+  uint64 vruntime;              // Run time weighted by 1/tickets
+  long vlag;                    // vruntime - rq->min_vruntime when p last left
+
+  // PBS
   int priority;                 // Priority of process
-  int in_queue;                 // Whether process is in queue
+  int dp;                       // Cached dynamic_priority(p)
+
+  // MLFQ
+  int level;                    // Queue level of process
+  int qlevel;                   // Level p is queued at, rq->lock
   int quanta;                   // Number of ticks process has been running
   int q_in_time;                
-  int qrtime[NMLFQ];
-  #endif
-};
-
-#ifdef MLFQ
-struct queue {
-  int head;
-  int tail;
-  int size;
-
-  struct proc* procs[NPROC];
+  uint64 qrtime[NMLFQ];         // Running time at each level, cycles
+  struct proc *mlfq_next;       // Next process on the same level, rq->lock
+  struct proc *mlfq_prev;       // Previous process on the same level, rq->lock
 };
-
-struct proc *top(struct queue *q);
-void queue_push(struct queue *q, struct proc *p);
-void queue_pop(struct queue *q);
-void queue_remove(struct queue *q, int pid);
-#endif
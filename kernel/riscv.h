@@ -256,6 +256,40 @@ r_mcounteren()
   return x;
 }
 
+// Machine Environment Configuration (privileged spec 1.12).
+// named by number for assemblers that don't know it.
+#define MENVCFG_STCE (1L << 63) // supervisor stimecmp enable
+static inline uint64
+r_menvcfg()
+{
+  uint64 x;
+  asm volatile("csrr %0, 0x30a" : "=r" (x) );
+  return x;
+}
+
+static inline void
+w_menvcfg(uint64 x)
+{
+  asm volatile("csrw 0x30a, %0" : : "r" (x));
+}
+
+// Supervisor Timer Compare, from the Sstc extension.
+// the supervisor timer interrupt is pending while
+// time >= stimecmp; writing it clears the interrupt.
+static inline uint64
+r_stimecmp()
+{
+  uint64 x;
+  asm volatile("csrr %0, 0x14d" : "=r" (x) );
+  return x;
+}
+
+static inline void
+w_stimecmp(uint64 x)
+{
+  asm volatile("csrw 0x14d, %0" : : "r" (x));
+}
+
 // machine-mode cycle counter
 static inline uint64
 r_time()
@@ -279,6 +313,14 @@ intr_off()
   w_sstatus(r_sstatus() & ~SSTATUS_SIE);
 }
 
+// wait for an interrupt; returns at once if one is pending,
+// even with device interrupts disabled.
+static inline void
+wfi()
+{
+  asm volatile("wfi");
+}
+
 // are device interrupts enabled?
 static inline int
 intr_get()
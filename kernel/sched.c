@@ -0,0 +1,1715 @@
+// Per-CPU run queues and the scheduling policies that pick from them.
+//
+// Every CPU keeps the RUNNABLE processes it is responsible for on
+// its own queue, protected by that queue's lock, so a scheduling
+// decision only looks at runnable work and CPUs don't contend on
+// each other's locks. A CPU with an empty queue steals from the
+// busiest one.
+//
+// A process is on at most one run queue, and only while RUNNABLE.
+// Whoever removes it from a queue owns it and may run it.
+//
+// All policies are compiled in. Each is a table of hooks (struct
+// policy) and the one in use can be changed at runtime with
+// setsched(); the SCHEDULER the kernel was built with is the
+// policy it boots with. policy is only changed with every run
+// queue lock held, so a hook called with any of them held sees
+// the same policy throughout.
+//
+// Processes in the deadline class (setdeadline()) are served
+// ahead of whichever policy is in use, see "Deadline class" below.
+//
+// Lock order: p->lock, then rq->lock.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sched.h"
+#include "defs.h"
+
+#if defined(FCFS)
+#define SCHED_DEFAULT SCHED_FCFS
+#elif defined(LBS)
+#define SCHED_DEFAULT SCHED_LBS
+#elif defined(PBS)
+#define SCHED_DEFAULT SCHED_PBS
+#elif defined(MLFQ)
+#define SCHED_DEFAULT SCHED_MLFQ
+#elif defined(STRIDE)
+#define SCHED_DEFAULT SCHED_STRIDE
+#elif defined(CFS)
+#define SCHED_DEFAULT SCHED_CFS
+#else
+#define SCHED_DEFAULT SCHED_RR
+#endif
+
+extern struct proc *procs[NPROC];
+
+static struct policy policies[NSCHED];
+static struct policy *policy = &policies[SCHED_DEFAULT];
+
+// Incremented on every change of policy. A process whose
+// p->schedgen is older still has the previous policy's state.
+static int schedgen = 1;
+
+// Serializes setsched().
+static struct spinlock schedlock;
+
+// Protects every rq->dlbw.
+static struct spinlock dllock;
+
+// Bandwidth of a whole cpu in the deadline class.
+#define DLBW1 (1L<<20)
+
+static int dl_before(struct proc*, struct proc*);
+static void runq_kick(struct cpu*);
+static struct cpu *pickcpu(struct proc*);
+static void heap_init(struct pheap*, int (*)(struct proc*, struct proc*));
+
+void
+runqinit(void)
+{
+  struct cpu *c;
+
+  initlock(&schedlock, "sched");
+  initlock(&dllock, "dl");
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    initqlock(&c->rq.lock, "runq", LK_TICKET);
+    c->rq.cpu = c;
+    c->rq.nrunnable = 0;
+    c->rq.head = 0;
+    c->rq.tail = 0;
+    c->rq.dlthrottled = 0;
+    c->rq.dlbw = 0;
+    heap_init(&c->rq.dl, dl_before);
+    if(policy->init)
+      policy->init(&c->rq);
+  }
+}
+
+// Heap of processes for policies that always run the process
+// with the smallest key. Operations take O(log NPROC).
+// The run queue's lock must be held.
+
+static void
+heap_init(struct pheap *h, int (*before)(struct proc*, struct proc*))
+{
+  h->n = 0;
+  h->before = before;
+}
+
+static void
+heap_swap(struct pheap *h, int i, int j)
+{
+  struct proc *t = h->procs[i];
+
+  h->procs[i] = h->procs[j];
+  h->procs[j] = t;
+  h->procs[i]->heapidx = i;
+  h->procs[j]->heapidx = j;
+}
+
+static void
+heap_up(struct pheap *h, int i)
+{
+  while(i > 0 && h->before(h->procs[i], h->procs[(i-1)/2])){
+    heap_swap(h, i, (i-1)/2);
+    i = (i-1)/2;
+  }
+}
+
+static void
+heap_down(struct pheap *h, int i)
+{
+  int l, r, m;
+
+  for(;;){
+    m = i;
+    l = 2*i + 1;
+    r = 2*i + 2;
+    if(l < h->n && h->before(h->procs[l], h->procs[m]))
+      m = l;
+    if(r < h->n && h->before(h->procs[r], h->procs[m]))
+      m = r;
+    if(m == i)
+      break;
+    heap_swap(h, i, m);
+    i = m;
+  }
+}
+
+static void
+heap_push(struct pheap *h, struct proc *p)
+{
+  if(h->n == NPROC)
+    panic("heap_push");
+  p->heapidx = h->n;
+  h->procs[h->n++] = p;
+  heap_up(h, p->heapidx);
+}
+
+static void
+heap_remove(struct pheap *h, struct proc *p)
+{
+  int i = p->heapidx;
+
+  if(i < 0 || i >= h->n || h->procs[i] != p)
+    panic("heap_remove");
+  h->n--;
+  if(i != h->n){
+    h->procs[i] = h->procs[h->n];
+    h->procs[i]->heapidx = i;
+    heap_down(h, i);
+    heap_up(h, h->procs[i]->heapidx);
+  }
+  p->heapidx = -1;
+}
+
+static struct proc*
+heap_top(struct pheap *h)
+{
+  return h->n > 0 ? h->procs[0] : 0;
+}
+
+// Restore p's place in h after its key changed.
+static void
+heap_fix(struct pheap *h, struct proc *p)
+{
+  heap_down(h, p->heapidx);
+  heap_up(h, p->heapidx);
+}
+
+// Give p the current policy's initial state if it last
+// ran or waited under another policy.
+// rq->lock must be held for some run queue.
+static void
+runq_adopt(struct proc *p)
+{
+  if(p->schedgen == schedgen)
+    return;
+  p->schedgen = schedgen;
+  if(policy->reset)
+    policy->reset(p);
+}
+
+// May p run on c?
+static int
+allowed(struct cpu *c, struct proc *p)
+{
+  return (p->affinity >> (c - cpus)) & 1;
+}
+
+// Append p to rq.
+// rq->lock must be held.
+static void
+runq_push(struct runq *rq, struct proc *p)
+{
+  if(p->rq)
+    panic("runq_push");
+  p->rq = rq;
+  if(p->dl_runtime){
+    heap_push(&rq->dl, p);
+    return;
+  }
+  runq_adopt(p);
+  p->rq_next = 0;
+  p->rq_prev = rq->tail;
+  if(rq->tail)
+    rq->tail->rq_next = p;
+  else
+    rq->head = p;
+  rq->tail = p;
+  rq->nrunnable++;
+  if(policy->enqueue)
+    policy->enqueue(rq, p);
+}
+
+// Unlink p from rq.
+// rq->lock must be held.
+static void
+runq_remove(struct runq *rq, struct proc *p)
+{
+  if(p->rq != rq)
+    panic("runq_remove");
+  if(p->dl_runtime){
+    heap_remove(&rq->dl, p);
+    p->rq = 0;
+    return;
+  }
+  if(policy->dequeue)
+    policy->dequeue(rq, p);
+  if(p->rq_prev)
+    p->rq_prev->rq_next = p->rq_next;
+  else
+    rq->head = p->rq_next;
+  if(p->rq_next)
+    p->rq_next->rq_prev = p->rq_prev;
+  else
+    rq->tail = p->rq_prev;
+  p->rq = 0;
+  p->rq_next = 0;
+  p->rq_prev = 0;
+  rq->nrunnable--;
+}
+
+// Move p, queued on rq, to the back of rq's list, as if it had
+// just arrived, leaving its place in the policy's queues alone.
+// rq->lock must be held.
+static void
+runq_totail(struct runq *rq, struct proc *p)
+{
+  if(p->rq != rq || p->dl_runtime)
+    panic("runq_totail");
+  if(p == rq->tail)
+    return;
+  if(p->rq_prev)
+    p->rq_prev->rq_next = p->rq_next;
+  else
+    rq->head = p->rq_next;
+  p->rq_next->rq_prev = p->rq_prev;
+  p->rq_next = 0;
+  p->rq_prev = rq->tail;
+  rq->tail->rq_next = p;
+  rq->tail = p;
+}
+
+// Time-sliced policies give up the cpu at every tick
+// if something else is waiting for it.
+static void
+timeslice_tick(struct cpu *c)
+{
+  if(c->proc && c->rq.nrunnable > 0)
+    resched_cpu(c);
+}
+
+// Round robin: oldest runnable process first.
+static struct proc*
+rr_pick(struct runq *rq)
+{
+  return rq->head;
+}
+
+// First come first served: process with the minimum
+// creation time, never preempted.
+static struct proc*
+fcfs_pick(struct runq *rq)
+{
+  struct proc *p, *proc_with_min_time = 0;
+
+  for(p = rq->head; p; p = p->rq_next){
+    if(proc_with_min_time == 0 || p->ctime < proc_with_min_time->ctime)
+      proc_with_min_time = p;
+  }
+  return proc_with_min_time;
+}
+
+void settickets(int tickets)
+{
+  struct proc *p = myproc();
+  acquire(&p->lock);
+  p->tickets = tickets;
+  release(&p->lock);
+}
+
+// Lottery scheduling: each run queue keeps the tickets of its
+// processes in a Fenwick tree indexed by proc slot, so the total
+// is at hand and finding the holder of a ticket takes O(log NPROC).
+
+// Add delta tickets to proc slot i.
+// rq->lock must be held.
+static void
+lbs_update(struct runq *rq, int i, int delta)
+{
+  for(i++; i <= NPROC; i += i & -i)
+    rq->tickets[i] += delta;
+  rq->totaltickets += delta;
+}
+
+// The queued process holding ticket t, 1 <= t <= rq->totaltickets.
+// rq->lock must be held.
+static struct proc*
+lbs_find(struct runq *rq, int t)
+{
+  int step, i = 0;
+
+  for(step = 1; step * 2 <= NPROC; step *= 2)
+    ;
+  for(; step > 0; step /= 2){
+    if(i + step <= NPROC && rq->tickets[i + step] < t){
+      i += step;
+      t -= rq->tickets[i];
+    }
+  }
+  return procs[i];
+}
+
+// from FreeBSD.
+int
+do_rand(unsigned long *ctx)
+{
+/*
+ * Compute x = (7^5 * x) mod (2^31 - 1)
+ * without overflowing 31 bits:
+ *      (2^31 - 1) = 127773 * (7^5) + 2836
+ * From "Random number generators: good ones are hard to find",
+ * Park and Miller, Communications of the ACM, vol. 31, no. 10,
+ * October 1988, p. 1195.
+ */
+    long hi, lo, x;
+
+    /* Transform to [1, 0x7ffffffe] range. */
+    x = (*ctx % 0x7ffffffe) + 1;
+    hi = x / 127773;
+    lo = x % 127773;
+    x = 16807 * lo - 2836 * hi;
+    if (x < 0)
+        x += 0x7fffffff;
+    /* Transform to [0, 0x7ffffffd] range. */
+    x--;
+    *ctx = x;
+    return (x);
+}
+
+static void
+lbs_init(struct runq *rq)
+{
+  memset(rq->tickets, 0, sizeof(rq->tickets));
+  rq->totaltickets = 0;
+  rq->seed = (rq->cpu - cpus) + 1;
+}
+
+static void
+lbs_reset(struct proc *p)
+{
+  p->comptickets = 0;
+}
+
+static void
+lbs_enqueue(struct runq *rq, struct proc *p)
+{
+  p->qtickets = p->tickets + p->comptickets;
+  lbs_update(rq, p->slot, p->qtickets);
+}
+
+static void
+lbs_dequeue(struct runq *rq, struct proc *p)
+{
+  lbs_update(rq, p->slot, -p->qtickets);
+}
+
+// Draw a ticket among the queued processes using this
+// cpu's random state; the process holding it wins.
+static struct proc*
+lbs_pick(struct runq *rq)
+{
+  if(rq->totaltickets <= 0)
+    return rq->head;
+  return lbs_find(rq, do_rand(&rq->seed) % rq->totaltickets + 1);
+}
+
+static void
+lbs_start(struct proc *p)
+{
+  p->comptickets = 0;
+}
+
+// A process that blocks after using only a fraction f of its
+// quantum gets its tickets inflated by 1/f until it next runs,
+// so that I/O-bound processes still receive their share.
+// used is how long p ran before blocking.
+static void
+lbs_putprev(struct runq *rq, struct proc *p, uint64 used)
+{
+  if(p->state != SLEEPING)
+    return;
+  // don't let a process that blocks immediately
+  // multiply its tickets without bound.
+  if(used < TICKINTERVAL / 16)
+    used = TICKINTERVAL / 16;
+  if(used < TICKINTERVAL)
+    p->comptickets = p->tickets * (TICKINTERVAL - used) / used;
+  else
+    p->comptickets = 0;
+}
+
+// Stride scheduling: each process advances its pass by its stride,
+// STRIDE1/tickets, for every quantum it runs, and the process with
+// the smallest pass runs next. Unlike the lottery this is
+// deterministic, so shares are accurate within a quantum rather
+// than only in the long run.
+//
+// rq->gpass tracks the pass of the last process picked. A process
+// leaving a queue remembers how far ahead of it it was and joins
+// its next queue that far ahead, so sleeping or moving to another
+// cpu neither earns nor costs it anything.
+
+static int
+stride_before(struct proc *a, struct proc *b)
+{
+  return a->pass < b->pass;
+}
+
+static void
+stride_init(struct runq *rq)
+{
+  heap_init(&rq->heap, stride_before);
+  rq->gpass = 0;
+}
+
+static void
+stride_reset(struct proc *p)
+{
+  p->pass = 0;
+  p->remain = 0;
+}
+
+static void
+stride_enqueue(struct runq *rq, struct proc *p)
+{
+  p->pass = rq->gpass + p->remain;
+  heap_push(&rq->heap, p);
+}
+
+static void
+stride_dequeue(struct runq *rq, struct proc *p)
+{
+  heap_remove(&rq->heap, p);
+  p->remain = p->pass - rq->gpass;
+}
+
+static struct proc*
+stride_pick(struct runq *rq)
+{
+  struct proc *p = heap_top(&rq->heap);
+
+  if(p && p->pass > rq->gpass)
+    rq->gpass = p->pass;
+  return p;
+}
+
+static void
+stride_putprev(struct runq *rq, struct proc *p, uint64 used)
+{
+  p->pass += STRIDE1 / p->tickets * used / TICKINTERVAL;
+  p->remain = p->pass - rq->gpass;
+}
+
+// Completely fair scheduling: a process's vruntime grows by the
+// time it runs divided by its tickets, and the queued process
+// with the smallest vruntime runs next, for a timeslice that is
+// its share of CFSLATENCY among the processes on its cpu, but at
+// least CFSMINGRAN.
+//
+// rq->min_vruntime only moves forward. A process leaving a queue
+// keeps its lag, how far its vruntime was above min_vruntime, and
+// rejoins a queue that far above that queue's min_vruntime. So a
+// long sleeper comes back level with the others rather than far
+// behind them, where it would starve them, and neither gains nor
+// loses by sleeping or moving between cpus.
+
+static int
+cfs_before(struct proc *a, struct proc *b)
+{
+  if(a->vruntime != b->vruntime)
+    return a->vruntime < b->vruntime;
+  return a->ctime < b->ctime;
+}
+
+// Advance rq->min_vruntime to the smallest vruntime among
+// the queued processes and cur, if not null.
+static void
+cfs_update_min(struct runq *rq, struct proc *cur)
+{
+  struct proc *top = heap_top(&rq->heap);
+  uint64 v;
+
+  if(top == 0 && cur == 0)
+    return;
+  if(top == 0)
+    v = cur->vruntime;
+  else if(cur == 0 || top->vruntime < cur->vruntime)
+    v = top->vruntime;
+  else
+    v = cur->vruntime;
+  if(v > rq->min_vruntime)
+    rq->min_vruntime = v;
+}
+
+static void
+cfs_init(struct runq *rq)
+{
+  heap_init(&rq->heap, cfs_before);
+  rq->min_vruntime = 0;
+  rq->load = 0;
+}
+
+static void
+cfs_reset(struct proc *p)
+{
+  p->vruntime = 0;
+  p->vlag = 0;
+}
+
+static void
+cfs_enqueue(struct runq *rq, struct proc *p)
+{
+  p->vruntime = rq->min_vruntime + p->vlag;
+  heap_push(&rq->heap, p);
+  rq->load += p->tickets;
+}
+
+static void
+cfs_dequeue(struct runq *rq, struct proc *p)
+{
+  heap_remove(&rq->heap, p);
+  rq->load -= p->tickets;
+  p->vlag = p->vruntime - rq->min_vruntime;
+}
+
+static struct proc*
+cfs_pick(struct runq *rq)
+{
+  cfs_update_min(rq, 0);
+  return heap_top(&rq->heap);
+}
+
+static void
+cfs_putprev(struct runq *rq, struct proc *p, uint64 used)
+{
+  p->vruntime += used / p->tickets;
+  cfs_update_min(rq, p);
+  p->vlag = p->vruntime - rq->min_vruntime;
+}
+
+// How long cur may run on a cpu with rq queued, in cycles.
+static uint64
+cfs_slice(struct runq *rq, struct proc *cur)
+{
+  uint64 period = CFSLATENCY;
+  uint64 slice;
+  int nr = rq->nrunnable + 1;
+
+  if(period < nr * CFSMINGRAN)
+    period = nr * CFSMINGRAN;
+  slice = period * cur->tickets / (rq->load + cur->tickets);
+  return slice < CFSMINGRAN ? CFSMINGRAN : slice;
+}
+
+// The running process has used up its slice.
+static void
+cfs_tick(struct cpu *c)
+{
+  struct proc *cur = c->proc;
+
+  if(cur && c->rq.nrunnable > 0 &&
+     r_time() - cur->qstart >= cfs_slice(&c->rq, cur))
+    resched_cpu(c);
+}
+
+// p is far enough behind c->proc, counting c->proc's current run.
+static int
+cfs_preempt(struct cpu *c, struct proc *p)
+{
+  struct proc *cur = c->proc;
+  uint64 v;
+
+  if(cur == 0 || cur == p)
+    return 0;
+  v = cur->vruntime + (r_time() - cur->qstart) / cur->tickets;
+  return p->vruntime + CFSMINGRAN/2 < v;
+}
+
+// Priority based scheduling: each run queue keeps its processes in
+// a heap ordered by their cached dynamic priority (p->dp), which
+// is brought up to date as a process wakes and on each tick while
+// it runs; it can't change while a process waits on a queue. A process that
+// becomes runnable with a better dynamic priority than the one
+// running on its cpu preempts it. A priority lent by a waiter on
+// a sleeplock (see "Priority inheritance") counts if it's better.
+
+// p's dynamic priority, or the one lent to it if better.
+static int
+pbs_dp(struct proc *p)
+{
+  return p->pirank < p->dp ? p->pirank : p->dp;
+}
+
+// Lowest dynamic priority first; ties go to the process
+// scheduled fewer times, then to the older one.
+static int
+pbs_before(struct proc *a, struct proc *b)
+{
+  if(pbs_dp(a) != pbs_dp(b))
+    return pbs_dp(a) < pbs_dp(b);
+  if(a->sched_count != b->sched_count)
+    return a->sched_count < b->sched_count;
+  return a->ctime < b->ctime;
+}
+
+static void
+pbs_init(struct runq *rq)
+{
+  heap_init(&rq->heap, pbs_before);
+}
+
+static void
+pbs_reset(struct proc *p)
+{
+  p->dp = dynamic_priority(p);
+}
+
+static void
+pbs_enqueue(struct runq *rq, struct proc *p)
+{
+  heap_push(&rq->heap, p);
+}
+
+static void
+pbs_dequeue(struct runq *rq, struct proc *p)
+{
+  heap_remove(&rq->heap, p);
+}
+
+static struct proc*
+pbs_pick(struct runq *rq)
+{
+  return heap_top(&rq->heap);
+}
+
+static void
+pbs_start(struct proc *p)
+{
+  p->rtime = 0;
+  p->stime = 0;
+  p->dp = dynamic_priority(p);
+}
+
+// p should run instead of c->proc.
+static int
+pbs_preempt(struct cpu *c, struct proc *p)
+{
+  struct proc *cur = c->proc;
+
+  return cur != 0 && cur != p && pbs_dp(p) < pbs_dp(cur);
+}
+
+static int
+pbs_rank(struct proc *p)
+{
+  return p->dp;
+}
+
+// The running process's dynamic priority may have
+// dropped below that of a waiting one.
+static void
+pbs_tick(struct cpu *c)
+{
+  struct proc *top;
+
+  if((top = heap_top(&c->rq.heap)) != 0 && pbs_preempt(c, top))
+    resched_cpu(c);
+}
+
+// p's priority changed; move it in its queue, and preempt
+// whichever process should now give way.
+// p->lock must be held.
+static void
+pbs_reprioritize(struct proc *p)
+{
+  struct runq *rq;
+  struct cpu *c;
+  int dp = dynamic_priority(p);
+
+  // p->dp orders p in a heap, so change it only under the
+  // lock of the queue p is on, or of the cpu it runs on.
+  if(p->state == RUNNABLE && (rq = p->rq) != 0){
+    acquire(&rq->lock);
+    p->dp = dp;
+    if(p->rq == rq && policy == &policies[SCHED_PBS]){
+      heap_fix(&rq->heap, p);
+      if(pbs_preempt(rq->cpu, p))
+        resched_cpu(rq->cpu);
+    }
+    release(&rq->lock);
+    return;
+  }
+  if(p->state == RUNNING){
+    for(c = cpus; c < &cpus[NCPU]; c++){
+      if(c->proc != p)
+        continue;
+      acquire(&c->rq.lock);
+      p->dp = dp;
+      if(policy == &policies[SCHED_PBS])
+        pbs_tick(c);
+      release(&c->rq.lock);
+      return;
+    }
+  }
+  p->dp = dp;
+}
+
+void set_priority(int priority, int pid, int* old_priority)
+{
+  struct proc *p = findproc(pid);
+
+  if(p == 0)
+    return;
+  acquire(&p->lock);
+  if(p->pid == pid && p->state != UNUSED) {
+    *old_priority = p->priority;
+    p->priority = priority;
+    p->rtime = 0;
+    p->stime = 0;
+    pbs_reprioritize(p);
+  }
+  release(&p->lock);
+}
+
+int dynamic_priority(struct proc *p)
+{
+  int niceness;
+  int dp;
+
+  if(p->rtime + p->stime != 0)
+    niceness = (p->stime / (p->rtime + p->stime)) * 10;
+  else
+  {
+    niceness = 5;
+  }
+
+  dp = p->priority - niceness + 5;
+
+  if(dp > 100)
+  {
+    dp = 100;
+  }
+  return dp;
+}
+
+// Multi-level feedback queue: each run queue also keeps one list
+// per level and a bitmap of the non-empty levels, so choosing the
+// next process and checking for preemption don't walk the queue.
+// A process is queued at its level, or at a better one lent to it
+// by a waiter on a sleeplock (see "Priority inheritance").
+
+// The level p is queued and preempted at.
+static int
+mlfq_level(struct proc *p)
+{
+  return p->pirank < p->level ? p->pirank : p->level;
+}
+
+static void
+mlfq_init(struct runq *rq)
+{
+  rq->levels = 0;
+  for(int i = 0; i < NMLFQ; i++){
+    rq->qhead[i] = 0;
+    rq->qtail[i] = 0;
+  }
+}
+
+static void
+mlfq_reset(struct proc *p)
+{
+  p->level = 0;
+  p->quanta = 1;
+}
+
+// Append p to the list of its level.
+static void
+mlfq_enqueue(struct runq *rq, struct proc *p)
+{
+  int l = mlfq_level(p);
+
+  p->qlevel = l;
+  p->q_in_time = ticks;
+  p->mlfq_next = 0;
+  p->mlfq_prev = rq->qtail[l];
+  if(rq->qtail[l])
+    rq->qtail[l]->mlfq_next = p;
+  else
+    rq->qhead[l] = p;
+  rq->qtail[l] = p;
+  rq->levels |= 1 << l;
+}
+
+// Unlink p from the list it was queued on.
+static void
+mlfq_dequeue(struct runq *rq, struct proc *p)
+{
+  int l = p->qlevel;
+
+  if(p->mlfq_prev)
+    p->mlfq_prev->mlfq_next = p->mlfq_next;
+  else
+    rq->qhead[l] = p->mlfq_next;
+  if(p->mlfq_next)
+    p->mlfq_next->mlfq_prev = p->mlfq_prev;
+  else
+    rq->qtail[l] = p->mlfq_prev;
+  p->mlfq_next = 0;
+  p->mlfq_prev = 0;
+  if(rq->qhead[l] == 0)
+    rq->levels &= ~(1 << l);
+}
+
+// First process of the highest non-empty level.
+static struct proc*
+mlfq_pick(struct runq *rq)
+{
+  int l;
+
+  for(l = 0; l < NMLFQ; l++)
+    if(rq->levels & (1 << l))
+      return rq->qhead[l];
+  return 0;
+}
+
+static void
+mlfq_start(struct proc *p)
+{
+  p->quanta = 1 << p->level;
+}
+
+// Move processes that have waited AGETICKS up one level; those
+// queued at level 0 keep their place there. The run queue list
+// is in order of arrival, so it doubles as the aging timer list:
+// only its expired head is looked at. Then demote the running
+// process if it used up its quanta, or preempt it if a process
+// of a higher level is waiting.
+static void
+mlfq_tick(struct cpu *c)
+{
+  struct runq *rq = &c->rq;
+  struct proc *p;
+
+  while((p = rq->head) != 0 && ticks - p->q_in_time >= AGETICKS){
+    if(p->level > 0)
+      p->level--;
+    if(p->qlevel > 0){
+      runq_remove(rq, p);
+      runq_push(rq, p);
+      continue;
+    }
+    // already queued at the top: only restart its wait.
+    p->q_in_time = ticks;
+    runq_totail(rq, p);
+  }
+
+  if((p = c->proc) == 0)
+    return;
+  if(p->quanta <= 0){
+    if(p->level < NMLFQ - 1)
+      p->level++;
+    resched_cpu(c);
+  } else if(rq->levels & ((1 << mlfq_level(p)) - 1)){
+    resched_cpu(c);
+  }
+}
+
+static int
+mlfq_rank(struct proc *p)
+{
+  return p->level;
+}
+
+void
+printstats()
+{
+  struct proc *p = myproc();
+  printf("pid: %d--->priority: %d\n", p->pid, p->level);
+}
+
+static struct policy policies[NSCHED] = {
+[SCHED_RR] {
+  .name = "rr",
+  .pick_next = rr_pick,
+  .tick = timeslice_tick,
+},
+[SCHED_FCFS] {
+  .name = "fcfs",
+  .pick_next = fcfs_pick,
+},
+[SCHED_LBS] {
+  .name = "lbs",
+  .init = lbs_init,
+  .reset = lbs_reset,
+  .enqueue = lbs_enqueue,
+  .dequeue = lbs_dequeue,
+  .pick_next = lbs_pick,
+  .start = lbs_start,
+  .putprev = lbs_putprev,
+  .tick = timeslice_tick,
+},
+[SCHED_PBS] {
+  .name = "pbs",
+  .init = pbs_init,
+  .reset = pbs_reset,
+  .enqueue = pbs_enqueue,
+  .dequeue = pbs_dequeue,
+  .pick_next = pbs_pick,
+  .start = pbs_start,
+  .tick = pbs_tick,
+  .preempt = pbs_preempt,
+  .rank = pbs_rank,
+},
+[SCHED_MLFQ] {
+  .name = "mlfq",
+  .init = mlfq_init,
+  .reset = mlfq_reset,
+  .enqueue = mlfq_enqueue,
+  .dequeue = mlfq_dequeue,
+  .pick_next = mlfq_pick,
+  .start = mlfq_start,
+  .tick = mlfq_tick,
+  .rank = mlfq_rank,
+},
+[SCHED_STRIDE] {
+  .name = "stride",
+  .init = stride_init,
+  .reset = stride_reset,
+  .enqueue = stride_enqueue,
+  .dequeue = stride_dequeue,
+  .pick_next = stride_pick,
+  .putprev = stride_putprev,
+  .tick = timeslice_tick,
+},
+[SCHED_CFS] {
+  .name = "cfs",
+  .init = cfs_init,
+  .reset = cfs_reset,
+  .enqueue = cfs_enqueue,
+  .dequeue = cfs_dequeue,
+  .pick_next = cfs_pick,
+  .putprev = cfs_putprev,
+  .tick = cfs_tick,
+  .preempt = cfs_preempt,
+},
+};
+
+// Priority inheritance: under a policy with a rank hook (PBS,
+// MLFQ), a process about to sleep waiting for a sleeplock lends
+// its rank to the holder if that is better than the holder's own,
+// so a holder of low priority isn't kept from running, and from
+// releasing the lock, by everything ranked in between. The best
+// rank lent to p is p->pirank, which the policy counts in place
+// of p's own when better. A holder gives back what was lent as it
+// releases a lock, keeping the best still waiting on the ones it
+// holds, see releasesleep().
+//
+// Lending is one level deep: a holder that is itself waiting for
+// another lock doesn't pass it on. Ranks lent under a policy that
+// has since been replaced last until the lock is released.
+
+// Number of times a process blocked on a sleeplock held by one
+// of lower priority.
+int pi_inversions;
+
+// p's rank under pol, counting one lent to it.
+// p->lock must be held.
+static int
+pi_effrank(struct policy *pol, struct proc *p)
+{
+  int r = pol->rank(p);
+
+  return p->pirank < r ? p->pirank : r;
+}
+
+// Set the rank lent to p, moving p in its run queue to match.
+// p->lock must be held.
+void
+pi_setrank(struct proc *p, int rank)
+{
+  struct runq *rq;
+
+  if(p->pirank == rank)
+    return;
+  if(p->state == RUNNABLE && !p->dl_runtime && (rq = p->rq) != 0){
+    acquire(&rq->lock);
+    if(p->rq == rq){
+      runq_remove(rq, p);
+      p->pirank = rank;
+      runq_push(rq, p);
+      if(policy->preempt && policy->preempt(rq->cpu, p))
+        resched_cpu(rq->cpu);
+      release(&rq->lock);
+      return;
+    }
+    release(&rq->lock);
+  }
+  p->pirank = rank;
+}
+
+// The calling process is about to sleep waiting for a sleeplock
+// held by owner: lend owner its rank if better, and lower
+// *waitrank, the best rank waiting for the lock, to it.
+// The sleeplock's spinlock must be held, which keeps owner
+// holding it.
+void
+pi_lend(struct proc *owner, int *waitrank)
+{
+  struct proc *p = myproc();
+  struct policy *pol = policy;
+  int r;
+
+  if(pol->rank == 0 || owner == 0 || owner == p)
+    return;
+  acquire(&p->lock);
+  r = pi_effrank(pol, p);
+  release(&p->lock);
+  if(r < *waitrank)
+    *waitrank = r;
+
+  acquire(&owner->lock);
+  if(r < pi_effrank(pol, owner)){
+    __sync_fetch_and_add(&pi_inversions, 1);
+    pi_setrank(owner, r);
+  }
+  release(&owner->lock);
+}
+
+// Deadline class: a process declares a runtime, deadline and
+// period in ticks, and within each period it is guaranteed its
+// runtime before its deadline. The class is served ahead of the
+// policy in use, earliest absolute deadline first.
+//
+// Admission keeps the sum of runtime/deadline of the processes
+// placed on each cpu at most 1, which is enough for EDF on one cpu
+// to meet every deadline, so a deadline process stays on the cpu
+// it was admitted to (p->dl_cpu) and is never stolen.
+//
+// runq_tick() charges a running process's budget every tick.
+// One that has used up its runtime is throttled: it waits on its
+// cpu's rq->dlthrottled list, not the heap, until its next period
+// begins. A process that still has budget left when its deadline
+// passes has missed it, which is counted in p->dl_misses.
+
+static int
+dl_before(struct proc *a, struct proc *b)
+{
+  if(a->dl_abs != b->dl_abs)
+    return a->dl_abs < b->dl_abs;
+  return a->ctime < b->ctime;
+}
+
+// Start p's next period if it has begun: at p->dl_next if p
+// has kept up, otherwise now.
+static void
+dl_refresh(struct proc *p)
+{
+  uint start;
+
+  if(ticks < p->dl_next)
+    return;
+  start = ticks - p->dl_next < p->dl_period ? p->dl_next : ticks;
+  p->dl_abs = start + p->dl_deadline;
+  p->dl_next = start + p->dl_period;
+  p->dl_budget = p->dl_runtime;
+  p->dl_missed = 0;
+}
+
+// Count a miss if p still wants cpu past its deadline.
+static void
+dl_check(struct proc *p)
+{
+  if(!p->dl_missed && p->dl_budget > 0 && ticks >= p->dl_abs){
+    p->dl_misses++;
+    p->dl_missed = 1;
+  }
+}
+
+// p should run instead of c->proc.
+static int
+dl_preempt(struct cpu *c, struct proc *p)
+{
+  struct proc *cur = c->proc;
+
+  return cur != 0 && cur != p &&
+    (cur->dl_runtime == 0 || p->dl_abs < cur->dl_abs);
+}
+
+// Queue RUNNABLE deadline process p on its cpu, or throttle
+// it there if it has used up this period's runtime.
+// p->lock must be held.
+static void
+dl_add(struct proc *p)
+{
+  struct cpu *c = &cpus[p->dl_cpu];
+
+  acquire(&c->rq.lock);
+  dl_refresh(p);
+  if(p->dl_budget <= 0){
+    p->rq_next = c->rq.dlthrottled;
+    c->rq.dlthrottled = p;
+  } else {
+    runq_push(&c->rq, p);
+    if(dl_preempt(c, p))
+      resched_cpu(c);
+  }
+  release(&c->rq.lock);
+  // a throttled process needs the tick to release it, too.
+  runq_kick(c);
+}
+
+// Timer interrupt on c: release throttled processes whose
+// period has begun, count misses, and throttle or preempt
+// the running process.
+// c->rq.lock must be held.
+static void
+dl_tick(struct cpu *c)
+{
+  struct runq *rq = &c->rq;
+  struct proc *p, **pp, *cur = c->proc;
+  int i;
+
+  for(pp = &rq->dlthrottled; (p = *pp) != 0; ){
+    if(ticks >= p->dl_next){
+      *pp = p->rq_next;
+      dl_refresh(p);
+      runq_push(rq, p);
+    } else {
+      pp = &p->rq_next;
+    }
+  }
+
+  for(i = 0; i < rq->dl.n; i++)
+    dl_check(rq->dl.procs[i]);
+  if(cur && cur->dl_runtime){
+    dl_check(cur);
+    if(cur->dl_budget <= 0)
+      resched_cpu(c);
+  }
+  if((p = heap_top(&rq->dl)) != 0 && dl_preempt(c, p))
+    resched_cpu(c);
+}
+
+// Put the calling process in the deadline class with the given
+// runtime, period and deadline in ticks, or take it out of the
+// class if runtime is 0. Returns -1 if the parameters are
+// invalid or no cpu p may run on has enough bandwidth left.
+int
+setdeadline(int runtime, int period, int deadline)
+{
+  struct proc *p = myproc();
+  struct cpu *c, *best = 0;
+  long bw = 0;
+
+  if(runtime < 0 ||
+     (runtime > 0 && (deadline < runtime || period < deadline)))
+    return -1;
+  if(runtime > 0)
+    bw = runtime * DLBW1 / deadline;
+
+  acquire(&p->lock);
+  acquire(&dllock);
+  if(p->dl_runtime)
+    cpus[p->dl_cpu].rq.dlbw -= p->dl_bw;
+  if(runtime > 0){
+    for(c = cpus; c < &cpus[NCPU]; c++){
+      if(!c->online || !allowed(c, p) || c->rq.dlbw + bw > DLBW1)
+        continue;
+      if(best == 0 || c->rq.dlbw < best->rq.dlbw)
+        best = c;
+    }
+    if(best == 0){
+      if(p->dl_runtime)
+        cpus[p->dl_cpu].rq.dlbw += p->dl_bw;
+      release(&dllock);
+      release(&p->lock);
+      return -1;
+    }
+    best->rq.dlbw += bw;
+  }
+  release(&dllock);
+
+  if(runtime > 0){
+    p->dl_cpu = best - cpus;
+    p->dl_bw = bw;
+    p->dl_period = period;
+    p->dl_deadline = deadline;
+    p->dl_next = ticks;
+    p->dl_budget = 0;
+  } else if(p->dl_runtime){
+    // the policy in use starts p afresh.
+    p->schedgen = 0;
+  }
+  p->dl_runtime = runtime;
+  // requeue p as its new class says.
+  resched_cpu(mycpu());
+  release(&p->lock);
+  return 0;
+}
+
+// Remove and return the process to run next from rq: the
+// earliest deadline if any, otherwise the policy's pick.
+// Returns 0 if there is none.
+static struct proc*
+runq_take(struct runq *rq)
+{
+  struct proc *p;
+
+  acquire(&rq->lock);
+  p = heap_top(&rq->dl);
+  if(p == 0 && rq->nrunnable > 0)
+    p = policy->pick_next(rq);
+  if(p)
+    runq_remove(rq, p);
+  release(&rq->lock);
+  return p;
+}
+
+// Remove and return a process for thief to steal from rq: the
+// oldest one that may run on thief, preferring one that did not
+// last run on rq's cpu, whose cache there may still be warm.
+// Deadline processes stay on the cpu they were admitted to.
+// Returns 0 if there is none.
+static struct proc*
+runq_takefor(struct runq *rq, struct cpu *thief)
+{
+  struct proc *p, *pick = 0;
+  int home = rq->cpu - cpus;
+
+  acquire(&rq->lock);
+  for(p = rq->head; p; p = p->rq_next){
+    // skip p if its cpu is still switching away from it,
+    // holding its lock; see sched().
+    if(!allowed(thief, p) || p == rq->cpu->proc)
+      continue;
+    if(p->lastcpu != home){
+      pick = p;
+      break;
+    }
+    if(pick == 0)
+      pick = p;
+  }
+  if(pick)
+    runq_remove(rq, pick);
+  release(&rq->lock);
+  return pick;
+}
+
+// Number of processes running on or waiting for c.
+// Read without locks, so only a hint.
+static int
+cpuload(struct cpu *c)
+{
+  return c->rq.nrunnable + c->rq.dl.n + (c->proc != 0);
+}
+
+// Take a process from the busiest other cpu's queue. It passes
+// through c's queue so that the policy places it relative to
+// the processes there.
+static struct proc*
+runq_steal(struct cpu *c)
+{
+  struct proc *p;
+  struct cpu *v, *victim = 0;
+  int most = 0;
+
+  for(v = cpus; v < &cpus[NCPU]; v++){
+    if(v == c || !v->online)
+      continue;
+    if(v->rq.nrunnable > most){
+      most = v->rq.nrunnable;
+      victim = v;
+    }
+  }
+  if(victim == 0)
+    return 0;
+  if((p = runq_takefor(&victim->rq, c)) == 0)
+    return 0;
+  acquire(&c->rq.lock);
+  runq_push(&c->rq, p);
+  release(&c->rq.lock);
+  return runq_take(&c->rq);
+}
+
+// Timer interrupt on this cpu: charge the running process,
+// then let the deadline class and the policy act.
+// Interrupts must be disabled.
+void
+runq_tick(void)
+{
+  struct cpu *c = mycpu();
+  struct proc *p;
+
+  if((p = c->proc) != 0){
+    chargetime(p);
+    p->quanta--;
+    p->dp = dynamic_priority(p);
+    if(p->dl_runtime)
+      p->dl_budget--;
+  }
+
+  acquire(&c->rq.lock);
+  dl_tick(c);
+  // the policy has no say over a deadline process.
+  if(policy->tick && !(c->proc && c->proc->dl_runtime))
+    policy->tick(c);
+  release(&c->rq.lock);
+}
+
+// Make c reschedule at its next trap, interrupting
+// it if it is another cpu.
+// Interrupts must be disabled.
+void
+resched_cpu(struct cpu *c)
+{
+  c->resched = 1;
+  if(c != mycpu())
+    sendipi(c, IPI_RESCHED);
+}
+
+// Has something asked this cpu to reschedule?
+int
+runq_needresched(void)
+{
+  int r;
+
+  push_off();
+  r = mycpu()->resched;
+  pop_off();
+  return r;
+}
+
+// Does c need its periodic tick? Cpu 0 always does, since it
+// keeps ticks going for everyone. The others
+// only need it to share the cpu between processes, to enforce
+// deadline budgets, or to count alarm ticks; an idle cpu or one
+// running a lone process can do without.
+// Read without locks; callers recheck, see timerupdate().
+int
+runq_needtick(struct cpu *c)
+{
+  struct proc *p = c->proc;
+
+  if(c == &cpus[0])
+    return 1;
+  if(c->rq.nrunnable > 0 || c->rq.dl.n > 0 || c->rq.dlthrottled)
+    return 1;
+  return p != 0 && (p->dl_runtime || p->ticks);
+}
+
+// Nothing is runnable on c: zero pages for kalloc_zeroed() while
+// that lasts, then stop its tick and wait in wfi until
+// an interrupt arrives. The cpu publishes c->idle before looking
+// at its queue again, so anyone queueing work on it either sees
+// the flag and wakes it with an IPI, or is seen here.
+void
+runq_idle(struct cpu *c)
+{
+  uint64 t;
+
+  // spend the time zeroing free pages, until there is work.
+  while(c->rq.nrunnable == 0 && c->rq.dl.n == 0 && kzero())
+    ;
+
+  intr_off();
+  c->idle = 1;
+  __sync_synchronize();
+  if(c->rq.nrunnable == 0 && c->rq.dl.n == 0){
+    t = r_time();
+    timerupdate();
+    wfi();
+    c->idletime += r_time() - t;
+  }
+  c->idle = 0;
+}
+
+// Make c look at its queue again if it is idle or has
+// stopped its tick; it can't be relied on to notice.
+// Interrupts must be disabled.
+static void
+runq_kick(struct cpu *c)
+{
+  if(c == mycpu())
+    timerupdate();
+  else if(c->idle || c->tickless)
+    sendipi(c, IPI_KICK);
+}
+
+// c has more work queued than it can run right now;
+// wake an idle cpu to steal some.
+// Interrupts must be disabled.
+static void
+runq_spill(struct cpu *c)
+{
+  struct cpu *v;
+
+  for(v = cpus; v < &cpus[NCPU]; v++){
+    if(v != c && v->idle){
+      sendipi(v, IPI_KICK);
+      return;
+    }
+  }
+}
+
+// Choose the next process for c to run, removing it from
+// its run queue. Returns 0 if there is no runnable work.
+struct proc*
+runq_pick(struct cpu *c)
+{
+  struct proc *p;
+
+  if((p = runq_take(&c->rq)) != 0)
+    return p;
+  return runq_steal(c);
+}
+
+// p, taken off a run queue and locked, is about to run on c.
+// If p may no longer run there, because its affinity changed
+// while it was queued, queue it where it may and return 0.
+int
+runq_allowed(struct cpu *c, struct proc *p)
+{
+  if(allowed(c, p))
+    return 1;
+  runq_add(pickcpu(p), p);
+  return 0;
+}
+
+// p, just taken off a run queue, is about to run.
+// p->lock must be held.
+void
+runq_start(struct proc *p)
+{
+  if(p->dl_runtime == 0 && policy->start)
+    policy->start(p);
+}
+
+// Queue RUNNABLE p on c.
+// p->lock must be held.
+void
+runq_add(struct cpu *c, struct proc *p)
+{
+  struct policy *pol;
+  int n;
+
+  if(p->state != RUNNABLE)
+    panic("runq_add");
+  if(p->dl_runtime){
+    dl_add(p);
+    return;
+  }
+  acquire(&c->rq.lock);
+  runq_push(&c->rq, p);
+  pol = policy;
+  n = c->rq.nrunnable;
+  release(&c->rq.lock);
+  if(pol->preempt && !(c->proc && c->proc->dl_runtime) && pol->preempt(c, p))
+    resched_cpu(c);
+  else
+    runq_kick(c);
+  if(n > 1)
+    runq_spill(c);
+}
+
+// p is giving up this cpu after running since p->qstart, and
+// has set p->state. Charge it for the time it ran and, if it
+// is still RUNNABLE, queue it here again.
+// Called by sched(), or after a direct switch away from p,
+// with p->lock held.
+void
+runq_putprev(struct proc *p)
+{
+  struct runq *rq = &mycpu()->rq;
+  uint64 used = r_time() - p->qstart;
+
+  if(p->dl_runtime){
+    if(p->state == RUNNABLE)
+      dl_add(p);
+    return;
+  }
+  acquire(&rq->lock);
+  runq_adopt(p);
+  if(policy->putprev)
+    policy->putprev(rq, p, used);
+  release(&rq->lock);
+  if(p->state == RUNNABLE)
+    runq_add(allowed(mycpu(), p) ? mycpu() : pickcpu(p), p);
+}
+
+// p is giving up this cpu in sched(). If it is RUNNABLE and
+// would be queued on this cpu again, charge it and queue it
+// now, while it is still this cpu's current process, and
+// return 1; otherwise leave it to runq_putprev() after the
+// switch and return 0.
+// p->lock must be held.
+int
+runq_requeue(struct proc *p)
+{
+  struct cpu *c = mycpu();
+
+  if(p->state != RUNNABLE)
+    return 0;
+  if(p->dl_runtime ? p->dl_cpu != c - cpus : !allowed(c, p))
+    return 0;
+  runq_putprev(p);
+  return 1;
+}
+
+// The cpu to queue p on: the least loaded online cpu that p
+// may run on. The cpu p last ran on counts as one process
+// lighter, since p's cache may still be warm there, and this
+// cpu wins ties. Falls back to this cpu before any is online.
+// Interrupts must be disabled.
+static struct cpu*
+pickcpu(struct proc *p)
+{
+  struct cpu *c, *best = 0;
+  int score, bestscore = 0;
+
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(!c->online || !allowed(c, p))
+      continue;
+    score = 2 * cpuload(c);
+    if(c - cpus == p->lastcpu)
+      score -= 2;
+    if(c == mycpu())
+      score--;
+    if(best == 0 || score < bestscore){
+      best = c;
+      bestscore = score;
+    }
+  }
+  return best ? best : mycpu();
+}
+
+// Make p RUNNABLE and queue it on a suitable cpu. A sleeper
+// is charged for the time it slept.
+// p->lock must be held.
+void
+setrunnable(struct proc *p)
+{
+  uint64 now;
+
+  if(p->state == SLEEPING){
+    now = r_time();
+    p->stime += now - p->tstamp;
+    p->tstamp = now;
+    p->dp = dynamic_priority(p);
+  }
+  p->state = RUNNABLE;
+  runq_add(pickcpu(p), p);
+}
+
+// Let the process with the given pid, or the caller if pid is 0,
+// run only on the cpus in mask, bit i for cpu i. A queued process
+// moves at once and a running one at its next switch. Returns -1
+// if there is no such process, if mask has no online cpu, or if
+// it leaves out the cpu a deadline process was admitted to.
+int
+setaffinity(int pid, int mask)
+{
+  struct proc *p;
+  struct runq *rq;
+  struct cpu *c;
+  int online = 0, moved;
+
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    if(c->online)
+      online |= 1 << (c - cpus);
+  if((mask & online) == 0)
+    return -1;
+  if(pid == 0)
+    pid = myproc()->pid;
+
+  if((p = findproc(pid)) == 0)
+    return -1;
+  acquire(&p->lock);
+  if(p->pid != pid || p->state == UNUSED){
+    release(&p->lock);
+    return -1;
+  }
+  if(p->dl_runtime && (mask & (1 << p->dl_cpu)) == 0){
+    release(&p->lock);
+    return -1;
+  }
+  p->affinity = mask;
+  if(p->state == RUNNABLE && (rq = p->rq) != 0 && !allowed(rq->cpu, p)){
+    // a steal in progress leaves p->rq 0 instead; whoever
+    // ends up with p moves it, see runq_allowed().
+    acquire(&rq->lock);
+    moved = p->rq == rq;
+    if(moved)
+      runq_remove(rq, p);
+    release(&rq->lock);
+    if(moved)
+      runq_add(pickcpu(p), p);
+  } else if(p->state == RUNNING){
+    for(c = cpus; c < &cpus[NCPU]; c++)
+      if(c->proc == p && !allowed(c, p))
+        resched_cpu(c);
+  }
+  release(&p->lock);
+  return 0;
+}
+
+// The policy in use, one of SCHED_*.
+int
+getsched(void)
+{
+  return policy - policies;
+}
+
+// Switch every cpu to policy id. Queued processes move to the
+// new policy's queues on the same cpu; the others are adopted
+// by it the next time they stop running, which every cpu is
+// asked to do now. Returns the previous policy, or -1 if id
+// is not a policy.
+int
+setsched(int id)
+{
+  struct cpu *c;
+  struct proc *p, *moved[NCPU], **tail;
+  int i, old;
+
+  if(id < 0 || id >= NSCHED)
+    return -1;
+
+  acquire(&schedlock);
+  old = getsched();
+  if(id == old){
+    release(&schedlock);
+    return old;
+  }
+
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    acquire(&c->rq.lock);
+
+  // dequeue everything under the old policy, keeping
+  // each queue's order.
+  for(i = 0; i < NCPU; i++){
+    tail = &moved[i];
+    while((p = cpus[i].rq.head) != 0){
+      runq_remove(&cpus[i].rq, p);
+      *tail = p;
+      tail = &p->rq_next;
+    }
+    *tail = 0;
+  }
+
+  policy = &policies[id];
+  schedgen++;
+  for(i = 0; i < NCPU; i++){
+    if(policy->init)
+      policy->init(&cpus[i].rq);
+    while((p = moved[i]) != 0){
+      moved[i] = p->rq_next;
+      p->rq_next = 0;
+      runq_push(&cpus[i].rq, p);
+    }
+  }
+
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(c->proc)
+      resched_cpu(c);
+    release(&c->rq.lock);
+  }
+  release(&schedlock);
+  return old;
+}
@@ -0,0 +1,9 @@
+// Scheduling policies, for setsched().
+#define SCHED_RR      0   // round robin
+#define SCHED_FCFS    1   // first come first served
+#define SCHED_LBS     2   // lottery
+#define SCHED_PBS     3   // priority
+#define SCHED_MLFQ    4   // multi-level feedback queue
+#define SCHED_STRIDE  5   // stride
+#define SCHED_CFS     6   // completely fair
+#define NSCHED        7
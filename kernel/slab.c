@@ -0,0 +1,209 @@
+// Slab allocator, for kernel objects smaller than a page.
+//
+// A cache hands out objects of one size. It carves pages from
+// kalloc() into slabs: a header at the start of the page, then
+// as many objects as fit, the free ones linked through their
+// first word. An object's slab is the page it lies in.
+//
+// Each cpu keeps a magazine of free objects per cache, so most
+// allocations and frees touch neither the cache's lock nor
+// another cpu's memory. An empty magazine is refilled with half
+// a magazine's worth from the slabs, and a full one gives half
+// back. A slab whose objects are all free goes back to kalloc(),
+// unless it is the cache's last.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NKCACHE  8    // Caches in the kernel
+#define MAGSIZE  16   // Objects in a full magazine
+
+struct slab {
+  struct kcache *cache;
+  struct slab *next;
+  struct slab *prev;
+  int inuse;                  // Objects handed out, or in magazines
+  void *free;                 // Free objects
+};
+
+#define SLABHDR  ((sizeof(struct slab) + 15) & ~15)
+
+struct magazine {
+  int n;
+  void *objs[MAGSIZE];
+};
+
+struct kcache {
+  struct spinlock lock;
+  char *name;
+  int size;                   // Object size, rounded up
+  int perslab;                // Objects in a slab
+  struct slab *partial;       // Slabs with free objects
+  struct slab *full;          // Slabs without
+  int nslab;                  // Pages in use
+  struct magazine mags[NCPU]; // Touched only by their cpu, interrupts off
+};
+
+static struct kcache caches[NKCACHE];
+static int ncache;
+
+// Create a cache of size-byte objects. Called at boot,
+// from one cpu.
+struct kcache*
+kcache_create(char *name, int size)
+{
+  struct kcache *c;
+
+  size = (size + 7) & ~7;
+  if(ncache == NKCACHE || size > PGSIZE - SLABHDR)
+    panic("kcache_create");
+  c = &caches[ncache++];
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - SLABHDR) / size;
+  return c;
+}
+
+static void
+slab_push(struct slab **head, struct slab *s)
+{
+  s->prev = 0;
+  s->next = *head;
+  if(*head)
+    (*head)->prev = s;
+  *head = s;
+}
+
+static void
+slab_unlink(struct slab **head, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    *head = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// A new slab of free objects, or 0.
+// c->lock must be held.
+static struct slab*
+slab_new(struct kcache *c)
+{
+  struct slab *s;
+  char *obj;
+  int i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->inuse = 0;
+  s->free = 0;
+  obj = (char*)s + SLABHDR + (c->perslab - 1) * c->size;
+  for(i = 0; i < c->perslab; i++, obj -= c->size){
+    *(void**)obj = s->free;
+    s->free = obj;
+  }
+  slab_push(&c->partial, s);
+  c->nslab++;
+  return s;
+}
+
+// Take a free object from c's slabs, or 0.
+// c->lock must be held.
+static void*
+slab_get(struct kcache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  if((s = c->partial) == 0 && (s = slab_new(c)) == 0)
+    return 0;
+  obj = s->free;
+  s->free = *(void**)obj;
+  s->inuse++;
+  if(s->free == 0){
+    slab_unlink(&c->partial, s);
+    slab_push(&c->full, s);
+  }
+  return obj;
+}
+
+// Give obj back to its slab.
+// c->lock must be held.
+static void
+slab_put(struct kcache *c, void *obj)
+{
+  struct slab *s = (struct slab*)PGROUNDDOWN((uint64)obj);
+
+  if(s->cache != c)
+    panic("slab_put");
+  if(s->free == 0){
+    slab_unlink(&c->full, s);
+    slab_push(&c->partial, s);
+  }
+  *(void**)obj = s->free;
+  s->free = obj;
+  if(--s->inuse == 0 && (s->prev || s->next)){
+    slab_unlink(&c->partial, s);
+    c->nslab--;
+    kfree((void*)s);
+  }
+}
+
+// Allocate an object from c, uninitialized.
+// Returns 0 if out of memory.
+void*
+kcache_alloc(struct kcache *c)
+{
+  struct magazine *m;
+  void *obj = 0;
+  void *o;
+
+  push_off();
+  m = &c->mags[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    while(m->n < MAGSIZE/2 && (o = slab_get(c)) != 0)
+      m->objs[m->n++] = o;
+    release(&c->lock);
+  }
+  if(m->n > 0)
+    obj = m->objs[--m->n];
+  pop_off();
+  return obj;
+}
+
+// Free an object allocated from c.
+void
+kcache_free(struct kcache *c, void *obj)
+{
+  struct magazine *m;
+
+  push_off();
+  m = &c->mags[cpuid()];
+  if(m->n == MAGSIZE){
+    acquire(&c->lock);
+    while(m->n > MAGSIZE/2)
+      slab_put(c, m->objs[--m->n]);
+    release(&c->lock);
+  }
+  m->objs[m->n++] = obj;
+  pop_off();
+}
+
+// Print each cache's use of memory. For debugging,
+// from procdump(); no locks.
+void
+kcachedump(void)
+{
+  struct kcache *c;
+
+  for(c = caches; c < &caches[ncache]; c++)
+    printf("cache %s size %d pages %d\n", c->name, c->size, c->nslab);
+}
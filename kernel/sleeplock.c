@@ -16,26 +16,80 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+  lk->owner = 0;
+  lk->waitrank = NORANK;
 }
 
+// Is lk's holder running on another cpu? Then it is likely to
+// release lk sooner than sleeping and being woken would take,
+// as buffer and inode locks are mostly held briefly. Not while
+// this cpu has been asked to reschedule, though. Read without
+// locks, as a hint.
+static int
+spinworthy(struct sleeplock *lk)
+{
+  struct proc *o = lk->owner;
+
+  return lk->locked && o != 0 && o != myproc() && o->state == RUNNING &&
+    !runq_needresched();
+}
+
+// Acquire lk, spinning while its holder runs on another
+// cpu and sleeping otherwise.
 void
 acquiresleep(struct sleeplock *lk)
 {
+  struct proc *p = myproc();
+
   acquire(&lk->lk);
   while (lk->locked) {
+    if(spinworthy(lk)){
+      release(&lk->lk);
+      while(spinworthy(lk))
+        __sync_synchronize();
+      acquire(&lk->lk);
+      continue;
+    }
+    // lend our priority to the holder while we wait.
+    pi_lend(lk->owner, &lk->waitrank);
     sleep(lk, &lk->lk);
   }
   lk->locked = 1;
-  lk->pid = myproc()->pid;
+  lk->pid = p->pid;
+  lk->owner = p;
+  lk->nextheld = p->held;
+  p->held = lk;
   release(&lk->lk);
 }
 
 void
 releasesleep(struct sleeplock *lk)
 {
+  struct proc *p = myproc();
+  struct sleeplock **pp, *l;
+  int rank = NORANK;
+
   acquire(&lk->lk);
+  for(pp = &p->held; *pp; pp = &(*pp)->nextheld){
+    if(*pp == lk){
+      *pp = lk->nextheld;
+      break;
+    }
+  }
+  // give back what lk's waiters lent us, keeping the best
+  // of what waiters on the locks we still hold lent.
+  for(l = p->held; l; l = l->nextheld)
+    if(l->waitrank < rank)
+      rank = l->waitrank;
+  acquire(&p->lock);
+  pi_setrank(p, rank);
+  release(&p->lock);
+
   lk->locked = 0;
   lk->pid = 0;
+  lk->owner = 0;
+  lk->waitrank = NORANK;
+  // the waiters that don't get lk lend again to whoever does.
   wakeup(lk);
   release(&lk->lk);
 }
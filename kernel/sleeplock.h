@@ -2,6 +2,9 @@
 struct sleeplock {
   uint locked;       // Is the lock held?
   struct spinlock lk; // spinlock protecting this sleep lock
+  struct proc *owner; // Process holding lock
+  int waitrank;      // Best rank lent by a waiter, or NORANK
+  struct sleeplock *nextheld; // Next lock held by owner
   
   // For debugging:
   char *name;        // Name of lock.
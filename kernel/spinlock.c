@@ -1,4 +1,15 @@
 // Mutual exclusion spin locks.
+//
+// A lock is test-and-set unless initqlock() chose otherwise.
+// Under contention test-and-set is unfair, and every waiter
+// hammers the lock's cache line. Ticket locks serve waiters in
+// the order they arrived; MCS locks do too, and each waiter spins
+// on its own qnode, which only its predecessor writes, so a
+// release disturbs one waiter rather than all.
+//
+// Every lock counts its acquisitions, the ones that had to wait
+// and how long they spun, and its longest hold. initlock() puts
+// it on a registry, which lockstat() reads.
 
 #include "types.h"
 #include "param.h"
@@ -7,13 +18,150 @@
 #include "riscv.h"
 #include "proc.h"
 #include "defs.h"
+#include "lockstat.h"
+
+// MCS locks a cpu can be holding or waiting for at once.
+#define NQNODE 4
+
+// Each cpu's qnodes, a cache line per cpu, and which are in use.
+// Only the cpu itself touches them, with interrupts off.
+static struct qnode qnodes[NCPU][NQNODE] __attribute__((aligned(64)));
+static uint qused[NCPU];
+
+// Registry of initialized locks. lockslock itself isn't on it.
+static struct spinlock lockslock;
+static struct spinlock *locks;
 
 void
 initlock(struct spinlock *lk, char *name)
+{
+  initqlock(lk, name, LK_TAS);
+}
+
+// Initialize a lock of the given kind, LK_*.
+void
+initqlock(struct spinlock *lk, char *name, int kind)
 {
   lk->name = name;
+  lk->kind = kind;
   lk->locked = 0;
+  lk->next = 0;
+  lk->serving = 0;
+  lk->tail = 0;
+  lk->qnode = 0;
   lk->cpu = 0;
+  lk->nacquire = 0;
+  lk->ncontend = 0;
+  lk->nspin = 0;
+  lk->maxhold = 0;
+
+  acquire(&lockslock);
+  lk->prevlock = 0;
+  lk->nextlock = locks;
+  if(locks)
+    locks->prevlock = lk;
+  locks = lk;
+  release(&lockslock);
+}
+
+// Take a lock off the registry before its memory is freed.
+void
+freelock(struct spinlock *lk)
+{
+  acquire(&lockslock);
+  if(lk->prevlock)
+    lk->prevlock->nextlock = lk->nextlock;
+  else
+    locks = lk->nextlock;
+  if(lk->nextlock)
+    lk->nextlock->prevlock = lk->prevlock;
+  release(&lockslock);
+}
+
+static struct qnode*
+qalloc(void)
+{
+  int id = cpuid();
+  int i;
+
+  for(i = 0; i < NQNODE; i++){
+    if((qused[id] & (1 << i)) == 0){
+      qused[id] |= 1 << i;
+      return &qnodes[id][i];
+    }
+  }
+  panic("qalloc");
+}
+
+static void
+qfree(struct qnode *q)
+{
+  int id = cpuid();
+
+  qused[id] &= ~(1 << (q - qnodes[id]));
+}
+
+// Take a ticket and wait until it is served.
+// Returns the number of spins.
+static uint64
+ticket_acquire(struct spinlock *lk)
+{
+  uint t = __sync_fetch_and_add(&lk->next, 1);
+  uint64 n = 0;
+
+  while(*(volatile uint*)&lk->serving != t)
+    n++;
+  return n;
+}
+
+static void
+ticket_release(struct spinlock *lk)
+{
+  __sync_fetch_and_add(&lk->serving, 1);
+}
+
+// Join the end of the line, then wait on our own qnode
+// for the cpu ahead to hand the lock over.
+// Returns the number of spins.
+static uint64
+mcs_acquire(struct spinlock *lk)
+{
+  struct qnode *q = qalloc();
+  struct qnode *prev;
+  uint64 n = 0;
+
+  q->next = 0;
+  q->wait = 1;
+  // an atomic swap, amoswap.d.
+  prev = __sync_lock_test_and_set(&lk->tail, q);
+  if(prev){
+    prev->next = q;
+    while(q->wait)
+      n++;
+  }
+  lk->qnode = q;
+  return n;
+}
+
+// Hand the lock to the next cpu in line, if any.
+static void
+mcs_release(struct spinlock *lk)
+{
+  struct qnode *q = lk->qnode;
+
+  lk->qnode = 0;
+  if(q->next == 0){
+    // nobody in line, unless someone has just swapped
+    // themselves in as the tail and not yet linked up.
+    if(__sync_bool_compare_and_swap(&lk->tail, q, 0)){
+      qfree(q);
+      return;
+    }
+    while(q->next == 0)
+      ;
+  }
+  q->next->wait = 0;
+  qfree(q);
 }
 
 // Acquire the lock.
@@ -21,16 +169,27 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint64 spins = 0;
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
-  //   a5 = 1
-  //   s1 = &lk->locked
-  //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  switch(lk->kind){
+  case LK_TICKET:
+    spins = ticket_acquire(lk);
+    break;
+  case LK_MCS:
+    spins = mcs_acquire(lk);
+    break;
+  default:
+    // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
+    //   a5 = 1
+    //   s1 = &lk->locked
+    //   amoswap.w.aq a5, a5, (s1)
+    while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
+      spins++;
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -39,16 +198,31 @@ acquire(struct spinlock *lk)
   __sync_synchronize();
 
   // Record info about lock acquisition for holding() and debugging.
+  // A queued lock's locked flag is only for holding().
+  lk->locked = 1;
   lk->cpu = mycpu();
+
+  lk->nacquire++;
+  if(spins){
+    lk->ncontend++;
+    lk->nspin += spins;
+  }
+  lk->tacquire = r_time();
 }
 
 // Release the lock.
 void
 release(struct spinlock *lk)
 {
+  uint64 held;
+
   if(!holding(lk))
     panic("release");
 
+  held = r_time() - lk->tacquire;
+  if(held > lk->maxhold)
+    lk->maxhold = held;
+
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -68,6 +242,11 @@ release(struct spinlock *lk)
   //   amoswap.w zero, zero, (s1)
   __sync_lock_release(&lk->locked);
 
+  if(lk->kind == LK_TICKET)
+    ticket_release(lk);
+  else if(lk->kind == LK_MCS)
+    mcs_release(lk);
+
   pop_off();
 }
 
@@ -108,3 +287,53 @@ pop_off(void)
   if(c->noff == 0 && c->intena)
     intr_on();
 }
+
+// Copy out to addr the statistics of up to n lock names, one
+// struct lockstat per name, and reset them all if asked.
+// Returns the number of names. Locks are read and reset without
+// being held, so a count may be off by the acquisitions under way.
+int
+lockstat(uint64 addr, int n, int reset)
+{
+  struct lockstat *ls;
+  struct spinlock *lk;
+  int nls = 0, max = PGSIZE / sizeof(*ls);
+  int i;
+
+  if((ls = (struct lockstat*)kalloc()) == 0)
+    return -1;
+
+  acquire(&lockslock);
+  for(lk = locks; lk; lk = lk->nextlock){
+    for(i = 0; i < nls; i++)
+      if(strncmp(ls[i].name, lk->name, sizeof(ls[i].name)-1) == 0)
+        break;
+    if(i == nls){
+      if(nls == max)
+        continue;
+      memset(&ls[i], 0, sizeof(ls[i]));
+      safestrcpy(ls[i].name, lk->name, sizeof(ls[i].name));
+      nls++;
+    }
+    ls[i].nlocks++;
+    ls[i].nacquire += lk->nacquire;
+    ls[i].ncontend += lk->ncontend;
+    ls[i].nspin += lk->nspin;
+    if(lk->maxhold > ls[i].maxhold)
+      ls[i].maxhold = lk->maxhold;
+    if(reset){
+      lk->nacquire = 0;
+      lk->ncontend = 0;
+      lk->nspin = 0;
+      lk->maxhold = 0;
+    }
+  }
+  release(&lockslock);
+
+  if(n > nls)
+    n = nls;
+  if(n > 0 && copyout(myproc()->pagetable, addr, (char*)ls, n*sizeof(*ls)) < 0)
+    nls = -1;
+  kfree((char*)ls);
+  return nls;
+}
@@ -1,9 +1,40 @@
+// Kinds of mutual exclusion lock, see initqlock().
+#define LK_TAS     0   // Test-and-set; cheapest when uncontended
+#define LK_TICKET  1   // Served in order; waiters spin on the lock
+#define LK_MCS     2   // Served in order; waiters spin on their own qnode
+
+// A cpu's place in line for an LK_MCS lock, see spinlock.c.
+struct qnode {
+  struct qnode *volatile next; // Next cpu in line
+  volatile int wait;           // Set until the previous holder hands over
+};
+
 // Mutual exclusion lock.
 struct spinlock {
   uint locked;       // Is the lock held?
+  int kind;          // LK_*
+
+  // LK_TICKET
+  uint next;         // Next ticket to hand out
+  uint serving;      // Ticket now holding the lock
+
+  // LK_MCS
+  struct qnode *tail;  // Last cpu in line, or null
+  struct qnode *qnode; // Holder's qnode
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // Statistics, see lockstat(); written by the holder
+  uint64 nacquire;   // Acquisitions
+  uint64 ncontend;   // Acquisitions that had to wait
+  uint64 nspin;      // Spin iterations spent waiting
+  uint64 maxhold;    // Longest hold, in cycles
+  uint64 tacquire;   // r_time() when acquired
+
+  // Registry of initialized locks, lockslock
+  struct spinlock *nextlock;
+  struct spinlock *prevlock;
 };
 
@@ -6,20 +6,32 @@
 
 void main();
 void timerinit();
+static int probesstc();
 
 // entry.S needs one stack per CPU.
 __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 
 // a scratch area per CPU for machine-mode timer interrupts.
-uint64 timer_scratch[NCPU][5];
+uint64 timer_scratch[NCPU][7];
 
 // assembly code in kernelvec.S for machine-mode timer interrupt.
 extern void timervec();
 
+// assembly code in kernelvec.S that skips a trapping instruction.
+extern void probevec();
+
+// does every hart implement the Sstc extension? if so the
+// supervisor programs its own timer with stimecmp, and machine
+// mode only forwards IPIs.
+int sstc;
+
 // entry.S jumps here in machine mode on stack0.
 void
 start()
 {
+  // before anything below that a trap would clobber.
+  sstc = probesstc();
+
   // set M Previous Privilege mode to Supervisor, for mret.
   unsigned long x = r_mstatus();
   x &= ~MSTATUS_MPP_MASK;
@@ -43,6 +55,10 @@ start()
   w_pmpaddr0(0x3fffffffffffffull);
   w_pmpcfg0(0xf);
 
+  // allow supervisor mode to read the time CSR,
+  // and to use stimecmp if there is one.
+  w_mcounteren(r_mcounteren() | 2);
+
   // ask for clock interrupts.
   timerinit();
 
@@ -54,11 +70,30 @@ start()
   asm volatile("mret");
 }
 
+// can this hart turn on Sstc? menvcfg only exists from
+// privileged spec 1.12 on, so touching it may trap; probevec
+// then skips the instruction, leaving 0 in x. STCE reads back
+// as 0 if the hart doesn't implement Sstc.
+// must run before mstatus.MPP and mepc are set up, which
+// a trap overwrites.
+static int
+probesstc()
+{
+  uint64 x;
+
+  w_mtvec((uint64)probevec);
+  asm volatile("li %0, 0\n"
+               "csrs 0x30a, %1\n"
+               "csrr %0, 0x30a\n"
+               : "=&r" (x) : "r" (MENVCFG_STCE) : "t6");
+  return (x & MENVCFG_STCE) != 0;
+}
+
 // arrange to receive timer interrupts.
-// they will arrive in machine mode at
-// at timervec in kernelvec.S,
-// which turns them into software interrupts for
-// devintr() in trap.c.
+// with Sstc they arrive in supervisor mode as supervisor
+// timer interrupts. otherwise they arrive in machine mode
+// at timervec in kernelvec.S, which turns them into
+// software interrupts for devintr() in trap.c.
 void
 timerinit()
 {
@@ -66,16 +101,22 @@ timerinit()
   int id = r_mhartid();
 
   // ask the CLINT for a timer interrupt.
-  int interval = 1000000; // cycles; about 1/10th second in qemu.
-  *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + interval;
+  int interval = TICKINTERVAL;
+  if(sstc)
+    w_stimecmp(r_time() + interval);
+  else
+    *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + interval;
 
   // prepare information in scratch[] for timervec.
   // scratch[0..2] : space for timervec to save registers.
   // scratch[3] : address of CLINT MTIMECMP register.
-  // scratch[4] : desired interval (in cycles) between timer interrupts.
+  // scratch[4] : unused.
+  // scratch[5] : set by timervec when the timer has gone off, for devintr().
+  // scratch[6] : address of CLINT MSIP register, for IPIs.
   uint64 *scratch = &timer_scratch[id][0];
   scratch[3] = CLINT_MTIMECMP(id);
-  scratch[4] = interval;
+  scratch[5] = 0;
+  scratch[6] = CLINT_MSIP(id);
   w_mscratch((uint64)scratch);
 
   // set the machine-mode trap handler.
@@ -84,6 +125,10 @@ timerinit()
   // enable machine-mode interrupts.
   w_mstatus(r_mstatus() | MSTATUS_MIE);
 
-  // enable machine-mode timer interrupts.
-  w_mie(r_mie() | MIE_MTIE);
+  // enable machine-mode software interrupts for IPIs,
+  // and timer interrupts unless the supervisor has its own.
+  if(sstc)
+    w_mie(r_mie() | MIE_MSIE);
+  else
+    w_mie(r_mie() | MIE_MTIE | MIE_MSIE);
 }
@@ -107,6 +107,11 @@ extern uint64 sys_sigreturn(void);
 extern uint64 sys_set_priority(void);
 extern uint64 sys_settickets(void);
 extern uint64 sys_waitx(void);
+extern uint64 sys_setsched(void);
+extern uint64 sys_setdeadline(void);
+extern uint64 sys_nanosleep(void);
+extern uint64 sys_setaffinity(void);
+extern uint64 sys_lockstat(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -138,6 +143,11 @@ static uint64 (*syscalls[])(void) = {
 [SYS_set_priority] sys_set_priority,
 [SYS_settickets] sys_settickets,
 [SYS_waitx]   sys_waitx,
+[SYS_setsched] sys_setsched,
+[SYS_setdeadline] sys_setdeadline,
+[SYS_nanosleep] sys_nanosleep,
+[SYS_setaffinity] sys_setaffinity,
+[SYS_lockstat] sys_lockstat,
 };
 
 // An array mapping syscall numbers from syscall.h
@@ -170,12 +180,17 @@ char *syscall_namelist[] = {
   [SYS_set_priority] "set_priority",
   [SYS_settickets] "settickets",
   [SYS_waitx]  "waitx",
+  [SYS_setsched] "setsched",
+  [SYS_setdeadline] "setdeadline",
+  [SYS_nanosleep] "nanosleep",
+  [SYS_setaffinity] "setaffinity",
+  [SYS_lockstat] "lockstat",
 };
 
 //An array mapping syscall numbers from syscall.h
 // to the number of args the command should have
 
-int syscall_argnums[26] = {0,1,1,1,3,1,2,2,1,1,0,1,1,0,2,3,3,1,2,1,1,1,2,0,1,1};
+int syscall_argnums[] = {0,1,1,1,3,1,2,2,1,1,0,1,1,0,2,3,3,1,2,1,1,1,2,0,1,1,3,1,3,1,2,3};
 void print_strace(struct proc *p, int j){
   printf("%d: syscall %s (", p->pid, syscall_namelist[j]);
   int no_args = syscall_argnums[--j];
@@ -28,3 +28,8 @@
 #define SYS_set_priority 25
 #define SYS_settickets 26
 #define SYS_waitx 27
+#define SYS_setsched 28
+#define SYS_setdeadline 29
+#define SYS_nanosleep 30
+#define SYS_setaffinity 31
+#define SYS_lockstat 32
@@ -5,6 +5,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "sched.h"
 
 uint64
 sys_exit(void)
@@ -52,20 +53,22 @@ uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   argint(0, &n);
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(killed(myproc())){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  if(n < 0)
+    n = 0;
+  return timer_sleep(r_time() + (uint64)n * TICKINTERVAL);
+}
+
+// sleep for a number of nanoseconds, to the resolution
+// of the time CSR rather than of the tick.
+uint64
+sys_nanosleep(void)
+{
+  uint64 ns;
+
+  argaddr(0, &ns);
+  return timer_sleep(r_time() + ns / (1000000000 / TIMEBASE));
 }
 
 uint64
@@ -106,6 +109,10 @@ sys_sigalarm()
   struct proc *p = myproc();
   argint(0, &p->ticks);
   argaddr(1, &p->hndlr);
+  // alarms count this cpu's ticks.
+  push_off();
+  timerupdate();
+  pop_off();
   return 0;
 }
 
@@ -123,9 +130,6 @@ sys_sigreturn(void)
 uint64
 sys_set_priority(void)
 {
-  #ifndef PBS
-  return -1;
-  #endif
   int priority, pid;
   int old_p = -1;
   argint(0, &priority);
@@ -137,11 +141,12 @@ sys_set_priority(void)
 uint64
 sys_settickets(void)
 {
-  #ifndef LBS
-  return -1;
-  #endif
   int tickets;
   argint(0, &tickets);
+  // NPROC processes at MAXTICKETS, times 16 with LBS
+  // compensation, must still fit a run queue's int sums.
+  if(tickets < 1 || tickets > MAXTICKETS)
+    return -1;
   settickets(tickets);
   return 0;
 }
@@ -162,3 +167,45 @@ sys_waitx(void)
     return -1;
   return ret;
 }
+
+uint64
+sys_setsched(void)
+{
+  int policy;
+
+  argint(0, &policy);
+  return setsched(policy);
+}
+
+uint64
+sys_setdeadline(void)
+{
+  int runtime, period, deadline;
+
+  argint(0, &runtime);
+  argint(1, &period);
+  argint(2, &deadline);
+  return setdeadline(runtime, period, deadline);
+}
+
+uint64
+sys_setaffinity(void)
+{
+  int pid, mask;
+
+  argint(0, &pid);
+  argint(1, &mask);
+  return setaffinity(pid, mask);
+}
+
+uint64
+sys_lockstat(void)
+{
+  uint64 addr;
+  int n, reset;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  argint(2, &reset);
+  return lockstat(addr, n, reset);
+}
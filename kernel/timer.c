@@ -0,0 +1,298 @@
+// Per-CPU timer wheels, for sleeping until a point in time.
+//
+// Times are r_time() values, in cycles of the CLINT's mtime.
+// A wheel counts in jiffies of 1<<JIFFYSHIFT cycles and has
+// NLEVEL levels of WHEELSIZE slots; a slot on level k spans
+// WHEELSIZE^k jiffies. A timer goes on the lowest level that
+// reaches its expiry, and moves down (cascades) when the wheel
+// gets to the start of its slot, so adding and removing a
+// timer take constant time however many are pending.
+//
+// Each cpu runs the timers on its own wheel from its timer
+// interrupt, and timerupdate() programs the comparator for
+// whichever comes first of the next tick and the earliest timer,
+// so a timer fires at its expiry, not at the tick after it.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "defs.h"
+
+#define JIFFYSHIFT 12                 // 4096 cycles, about 0.4ms in qemu
+#define WHEELBITS  6
+#define WHEELSIZE  (1 << WHEELBITS)
+#define NLEVEL     4                  // reaches 2^36 cycles, about 2 hours
+
+struct wheel;
+
+struct timer {
+  uint64 expires;             // r_time() at which fn runs
+  void (*fn)(void*);          // Called with the wheel locked
+  void *arg;
+  struct wheel *w;            // Wheel the timer is on, or null
+  int level;                  // Slot the timer is in
+  int slot;
+  struct timer *next;
+  struct timer *prev;
+};
+
+struct wheel {
+  struct spinlock lock;
+  uint64 now;                 // Jiffy whose slot is current
+  uint64 next;                // Earliest time a timer may need attention
+  uint64 used[NLEVEL];        // Bit i is set if slot i of a level is non-empty
+  struct timer *slots[NLEVEL][WHEELSIZE];
+};
+
+static struct wheel wheels[NCPU];
+
+void
+wheelinit(void)
+{
+  struct wheel *w;
+
+  for(w = wheels; w < &wheels[NCPU]; w++){
+    initlock(&w->lock, "wheel");
+    w->now = r_time() >> JIFFYSHIFT;
+    w->next = ~0ULL;
+  }
+}
+
+static int
+lowbit(uint64 x)
+{
+  int i;
+
+  for(i = 0; (x & 1) == 0; i++)
+    x >>= 1;
+  return i;
+}
+
+// Put t on w, in the slot that holds its expiry.
+// A timer already due goes in the current slot.
+static void
+wheel_insert(struct wheel *w, struct timer *t)
+{
+  uint64 j = t->expires >> JIFFYSHIFT;
+  uint64 delta;
+  int k, i;
+
+  if(j < w->now)
+    j = w->now;
+  delta = j - w->now;
+  for(k = 0; k < NLEVEL-1; k++)
+    if(delta < (1ULL << (WHEELBITS*(k+1))))
+      break;
+  // beyond the top level: park in its farthest slot,
+  // and cascade round again from there.
+  if(delta >= (1ULL << (WHEELBITS*NLEVEL)))
+    j = w->now + (1ULL << (WHEELBITS*NLEVEL)) - 1;
+  i = (j >> (WHEELBITS*k)) & (WHEELSIZE-1);
+
+  t->w = w;
+  t->level = k;
+  t->slot = i;
+  t->prev = 0;
+  t->next = w->slots[k][i];
+  if(t->next)
+    t->next->prev = t;
+  w->slots[k][i] = t;
+  w->used[k] |= 1ULL << i;
+}
+
+static void
+wheel_remove(struct wheel *w, struct timer *t)
+{
+  if(t->prev)
+    t->prev->next = t->next;
+  else
+    w->slots[t->level][t->slot] = t->next;
+  if(t->next)
+    t->next->prev = t->prev;
+  if(w->slots[t->level][t->slot] == 0)
+    w->used[t->level] &= ~(1ULL << t->slot);
+  t->w = 0;
+}
+
+// The first jiffy from w->now on at which a slot of w is due
+// or cascades, and that slot's level; ~0 if w is empty.
+static uint64
+wheel_nextjiffy(struct wheel *w, int *level)
+{
+  uint64 best = ~0ULL, j, base, ahead;
+  int k, shift, pos;
+
+  for(k = 0; k < NLEVEL; k++){
+    if(w->used[k] == 0)
+      continue;
+    shift = WHEELBITS*k;
+    pos = (w->now >> shift) & (WHEELSIZE-1);
+    base = (w->now >> (shift + WHEELBITS)) << (shift + WHEELBITS);
+    // the current slot of a higher level has already cascaded,
+    // so anything in it is a round ahead.
+    if(k > 0)
+      pos++;
+    ahead = pos < WHEELSIZE ? w->used[k] & (~0ULL << pos) : 0;
+    if(ahead)
+      j = base + ((uint64)lowbit(ahead) << shift);
+    else
+      j = base + (1ULL << (shift + WHEELBITS)) +
+        ((uint64)lowbit(w->used[k]) << shift);
+    if(j < best){
+      best = j;
+      *level = k;
+    }
+  }
+  return best;
+}
+
+// Recompute w->next, for timerupdate(). A level-0 slot gives
+// the exact expiry of its earliest timer; a higher slot the
+// time it cascades.
+static void
+wheel_update(struct wheel *w)
+{
+  struct timer *t;
+  uint64 j, next;
+  int k;
+
+  j = wheel_nextjiffy(w, &k);
+  if(j == ~0ULL){
+    w->next = ~0ULL;
+    return;
+  }
+  next = j << JIFFYSHIFT;
+  if(k == 0){
+    next = ~0ULL;
+    for(t = w->slots[0][j & (WHEELSIZE-1)]; t; t = t->next)
+      if(t->expires < next)
+        next = t->expires;
+  }
+  w->next = next;
+}
+
+// The wheel has reached the start of a level-1 slot: move the
+// timers in the slots that start here down a level.
+static void
+wheel_cascade(struct wheel *w)
+{
+  struct timer *t, *next;
+  int k, i;
+
+  for(k = 1; k < NLEVEL; k++){
+    i = (w->now >> (WHEELBITS*k)) & (WHEELSIZE-1);
+    t = w->slots[k][i];
+    w->slots[k][i] = 0;
+    w->used[k] &= ~(1ULL << i);
+    for(; t; t = next){
+      next = t->next;
+      wheel_insert(w, t);
+    }
+    if(i != 0)
+      break;
+  }
+}
+
+// Run the timers in w's current slot that are due by now.
+static void
+wheel_expire(struct wheel *w, uint64 now)
+{
+  struct timer *t, *next;
+
+  for(t = w->slots[0][w->now & (WHEELSIZE-1)]; t; t = next){
+    next = t->next;
+    if(t->expires <= now){
+      wheel_remove(w, t);
+      t->fn(t->arg);
+    }
+  }
+}
+
+// Run the timers on this cpu's wheel that are due.
+// Called from the timer interrupt.
+void
+timer_run(void)
+{
+  struct wheel *w = &wheels[cpuid()];
+  uint64 now = r_time();
+  uint64 target = now >> JIFFYSHIFT;
+  uint64 j;
+  int k;
+
+  acquire(&w->lock);
+  for(;;){
+    wheel_expire(w, now);
+    if(w->now >= target)
+      break;
+    // skip straight to the next slot with something in it;
+    // the slots and cascades in between are empty.
+    j = wheel_nextjiffy(w, &k);
+    if(j <= w->now)
+      j = w->now + 1;
+    if(j > target)
+      j = target;
+    w->now = j;
+    if((j & (WHEELSIZE-1)) == 0)
+      wheel_cascade(w);
+  }
+  wheel_update(w);
+  release(&w->lock);
+}
+
+// The earliest time this cpu's wheel needs its timer interrupt,
+// or ~0. Read without the lock: only this cpu adds timers to
+// its wheel, and a remote removal only makes it early.
+uint64
+timer_next(void)
+{
+  return wheels[cpuid()].next;
+}
+
+static void
+timer_wakeup(void *chan)
+{
+  wakeup(chan);
+}
+
+// Sleep until r_time() reaches when, or until killed.
+// Returns 0, or -1 if killed.
+int
+timer_sleep(uint64 when)
+{
+  struct proc *p = myproc();
+  struct timer t;
+  struct wheel *w;
+  int r = 0;
+
+  if(when <= r_time())
+    return 0;
+
+  // the timer goes on this cpu's wheel; acquire() keeps
+  // interrupts off, so we stay on the cpu until it's armed.
+  push_off();
+  w = &wheels[cpuid()];
+  acquire(&w->lock);
+  pop_off();
+
+  t.expires = when;
+  t.fn = timer_wakeup;
+  t.arg = &t;
+  wheel_insert(w, &t);
+  wheel_update(w);
+  timerupdate();
+
+  // t lives on this stack, so it must be off the wheel,
+  // fired or removed, before returning.
+  while(t.w){
+    if(killed(p)){
+      wheel_remove(w, &t);
+      wheel_update(w);
+      r = -1;
+      break;
+    }
+    sleep(&t, &w->lock);
+  }
+  release(&w->lock);
+  return r;
+}
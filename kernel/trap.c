@@ -11,9 +11,9 @@ uint ticks;
 
 extern char trampoline[], uservec[], userret[];
 
-#ifdef MLFQ
-extern struct queue mlfq[NMLFQ];
-#endif
+// in start.c; timervec sets [hart][5] when a tick is pending.
+extern uint64 timer_scratch[NCPU][7];
+extern int sstc;
 
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
@@ -23,7 +23,7 @@ extern int devintr();
 void
 trapinit(void)
 {
-  initlock(&tickslock, "time");
+  initqlock(&tickslock, "time", LK_MCS);
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -96,32 +96,10 @@ usertrap(void)
   if(killed(p))
     exit(-1);
 
-  // preempt only when using round-robin scheduler or the lottery scheduler
-  #if defined(ROUND_ROBIN) || defined(LBS)
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2)
+  // the policy at a timer tick, a wakeup or another cpu
+  // asked this cpu to pick again.
+  if(runq_needresched())
     yield();
-  #endif
-
-
-  #ifdef MLFQ
-  if(which_dev == 2 && myproc() && myproc()->state == RUNNING)
-  {
-    struct proc *p = myproc();
-    if(p->quanta <= 0)
-    {
-      p->priority = p->priority != NMLFQ -1 ? p->priority + 1 : p->priority;
-      yield();
-    }
-    for(int i = 0; i < p->priority; i++)
-    {
-      if(mlfq[i].size)
-      {
-        yield();
-      }
-    }
-  }
-  #endif
 
   usertrapret();
 }
@@ -193,30 +171,10 @@ kerneltrap()
     panic("kerneltrap");
   }
 
-  // preempt only when using round-robin scheduler or the lottery scheduler
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
-  {
-  #if defined(ROUND_ROBIN) || defined(LBS)
+  // the policy at a timer tick, a wakeup or another cpu
+  // asked this cpu to pick again.
+  if(myproc() != 0 && myproc()->state == RUNNING && runq_needresched())
     yield();
-  #endif
-
-  #ifdef MLFQ
-    struct proc *p = myproc();
-    if(p->quanta <= 0)
-    {
-      p->priority = p->priority != NMLFQ -1 ? p->priority + 1 : p->priority;
-      yield();
-    }
-    for(int i = 0; i < p->priority; i++)
-    {
-      if(mlfq[i].size)
-      {
-        yield();
-      }
-    }
-    #endif
-  }
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -229,14 +187,146 @@ clockintr()
 {
   acquire(&tickslock);
   ticks++;
-  update_time();
-  wakeup(&ticks);
   release(&tickslock);
 }
 
-// check if it's an external interrupt or software interrupt,
+// interrupt cpu c with a supervisor software interrupt,
+// for the IPI_* reasons in why. reasons sent before c gets
+// round to them are handled together, see ipiintr().
+void
+sendipi(struct cpu *c, int why)
+{
+  __sync_fetch_and_or(&c->ipi, why);
+  __sync_synchronize();
+  *(uint32*)CLINT_MSIP(c - cpus) = 1;
+}
+
+// flush this cpu's TLB, for a tlbshootdown() from another cpu.
+// c->tlbreq is read before the flush, so every request up to
+// the one recorded in c->tlbdone was made before it.
+static void
+tlbflush(struct cpu *c)
+{
+  uint req = c->tlbreq;
+
+  __sync_synchronize();
+  sfence_vma();
+  __sync_synchronize();
+  c->tlbdone = req;
+}
+
+// make every online cpu flush its TLB, after a change to page
+// table entries that other cpus may have cached, such as the
+// kernel's. returns once they all have. waiting cpus handle
+// each other's requests, but one spinning for a lock that the
+// caller holds could not, so the caller must hold no spinlocks.
+void
+tlbshootdown(void)
+{
+  struct cpu *c, *me;
+  uint req[NCPU];
+
+  push_off();
+  me = mycpu();
+  sfence_vma();
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(c == me || !c->online)
+      continue;
+    req[c - cpus] = __sync_add_and_fetch(&c->tlbreq, 1);
+    sendipi(c, IPI_TLB);
+  }
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(c == me || !c->online)
+      continue;
+    while((int)(c->tlbdone - req[c - cpus]) < 0){
+      if(me->tlbdone != me->tlbreq)
+        tlbflush(me);
+      __sync_synchronize();
+    }
+  }
+  pop_off();
+}
+
+// handle the IPIs sent to this cpu since it last looked.
+static void
+ipiintr(void)
+{
+  struct cpu *c = mycpu();
+  int why = __sync_lock_test_and_set(&c->ipi, 0);
+
+  if(why & IPI_TLB)
+    tlbflush(c);
+  // work queued here may need the tick again, and a
+  // reschedule happens on the way out of the trap, as
+  // c->resched says.
+  if(why & (IPI_KICK | IPI_RESCHED))
+    timerupdate();
+}
+
+// start or stop this cpu's periodic tick as runq_needtick()
+// says, then set the comparator for the next tick or the
+// earliest timer on this cpu's wheel, whichever is first.
+// a stopped tick is restarted from scratch, one interval
+// from now. the stopping side publishes c->tickless before
+// looking again, so whoever queues work on c either sees it
+// and kicks c with an IPI, or is seen here.
+// interrupts must be disabled.
+void
+timerupdate(void)
+{
+  struct cpu *c = mycpu();
+  uint64 when;
+
+  if(runq_needtick(c)){
+    if(c->tickless){
+      c->tickless = 0;
+      c->nexttick = r_time() + TICKINTERVAL;
+    }
+  } else if(!c->tickless){
+    c->tickless = 1;
+    __sync_synchronize();
+    if(runq_needtick(c))
+      c->tickless = 0;
+  }
+
+  when = c->tickless ? ~0ULL : c->nexttick;
+  if(timer_next() < when)
+    when = timer_next();
+  if(sstc)
+    w_stimecmp(when);
+  else
+    *(uint64*)CLINT_MTIMECMP(cpuid()) = when;
+}
+
+// this cpu's timer went off: run the timers that are due,
+// and tick if the tick is due.
+// returns 2 if it ticked, 1 if not.
+static int
+timerintr(void)
+{
+  struct cpu *c = mycpu();
+  uint64 now = r_time();
+  int which = 1;
+
+  timer_run();
+  if(!c->tickless && now >= c->nexttick){
+    // keep the cadence, unless we've fallen a whole tick behind.
+    c->nexttick += TICKINTERVAL;
+    if(c->nexttick <= now)
+      c->nexttick = now + TICKINTERVAL;
+    if(cpuid() == 0){
+      clockintr();
+    }
+    runq_tick();
+    which = 2;
+  }
+  timerupdate();
+  return which;
+}
+
+// check if it's an external, software or timer interrupt,
 // and handle it.
-// returns 2 if timer interrupt,
+// returns 2 if timer tick,
 // 1 if other device,
 // 0 if not recognized.
 int
@@ -267,18 +357,25 @@ devintr()
 
     return 1;
   } else if(scause == 0x8000000000000001L){
-    // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // software interrupt from a machine-mode timer interrupt
+    // or an IPI, forwarded by timervec in kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
-    // the SSIP bit in sip.
+    // the SSIP bit in sip, before finding out why it came.
     w_sip(r_sip() & ~2);
 
-    return 2;
+    // an IPI, the timer, or both.
+    ipiintr();
+    if(__sync_lock_test_and_set(&timer_scratch[cpuid()][5], 0) == 0)
+      return 1;
+
+    return timerintr();
+  } else if(scause == 0x8000000000000005L){
+    // supervisor timer interrupt, from stimecmp (Sstc).
+
+    // timerupdate() sets the next deadline, which also
+    // clears this one.
+    return timerintr();
   } else {
     return 0;
   }
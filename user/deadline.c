@@ -0,0 +1,24 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// Run a command with a guaranteed runtime, in ticks, within
+// each period, before the given deadline.
+int main(int argc, char *argv[])
+{
+    if (argc < 5)
+    {
+        fprintf(2, "usage: deadline runtime period deadline command [args ...]\n");
+        exit(1);
+    }
+
+    if (setdeadline(atoi(argv[1]), atoi(argv[2]), atoi(argv[3])) < 0)
+    {
+        fprintf(2, "deadline: rejected\n");
+        exit(1);
+    }
+
+    exec(argv[4], &argv[4]);
+    fprintf(2, "deadline: exec %s failed\n", argv[4]);
+    exit(1);
+}
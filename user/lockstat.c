@@ -0,0 +1,73 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+#define NSTAT 64
+#define NTOP  10
+
+struct lockstat ls[NSTAT];
+
+// Print the NTOP most contended lock names, most first.
+void print(int n)
+{
+    struct lockstat t;
+    int i, j;
+
+    for (i = 0; i < n; i++)
+        for (j = i + 1; j < n; j++)
+            if (ls[j].ncontend > ls[i].ncontend ||
+                (ls[j].ncontend == ls[i].ncontend && ls[j].nacquire > ls[i].nacquire))
+            {
+                t = ls[i];
+                ls[i] = ls[j];
+                ls[j] = t;
+            }
+
+    printf("name\t\tlocks\tacquire\tcontend\tspins\tmaxhold\n");
+    for (i = 0; i < n && i < NTOP; i++)
+        printf("%s\t%s%d\t%l\t%l\t%l\t%l\n", ls[i].name, strlen(ls[i].name) < 8 ? "\t" : "",
+               ls[i].nlocks, ls[i].nacquire, ls[i].ncontend, ls[i].nspin, ls[i].maxhold);
+}
+
+// With no arguments, print the lock statistics since boot or the
+// last reset; with -r, reset them; with a command, reset them, run
+// the command and print them.
+int main(int argc, char *argv[])
+{
+    int n, pid;
+
+    if (argc == 2 && strcmp(argv[1], "-r") == 0)
+    {
+        lockstat(0, 0, 1);
+        exit(0);
+    }
+
+    if (argc > 1)
+    {
+        lockstat(0, 0, 1);
+        pid = fork();
+        if (pid < 0)
+        {
+            fprintf(2, "lockstat: fork failed\n");
+            exit(1);
+        }
+        if (pid == 0)
+        {
+            exec(argv[1], &argv[1]);
+            fprintf(2, "lockstat: exec %s failed\n", argv[1]);
+            exit(1);
+        }
+        wait(0);
+    }
+
+    if ((n = lockstat(ls, NSTAT, 0)) < 0)
+    {
+        fprintf(2, "lockstat: failed\n");
+        exit(1);
+    }
+    if (n > NSTAT)
+        n = NSTAT;
+    print(n);
+    exit(0);
+}
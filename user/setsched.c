@@ -0,0 +1,42 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/sched.h"
+#include "user/user.h"
+
+char *names[] = {
+  [SCHED_RR]     "rr",
+  [SCHED_FCFS]   "fcfs",
+  [SCHED_LBS]    "lbs",
+  [SCHED_PBS]    "pbs",
+  [SCHED_MLFQ]   "mlfq",
+  [SCHED_STRIDE] "stride",
+  [SCHED_CFS]    "cfs",
+};
+
+int main(int argc, char *argv[])
+{
+    int i, old;
+
+    if (argc != 2)
+    {
+        fprintf(2, "usage: setsched rr|fcfs|lbs|pbs|mlfq|stride|cfs\n");
+        exit(1);
+    }
+
+    for (i = 0; i < NSCHED; i++)
+        if (strcmp(argv[1], names[i]) == 0)
+            break;
+    if (i == NSCHED)
+    {
+        fprintf(2, "setsched: unknown policy %s\n", argv[1]);
+        exit(1);
+    }
+
+    if ((old = setsched(i)) < 0)
+    {
+        fprintf(2, "setsched: failed\n");
+        exit(1);
+    }
+    printf("%s -> %s\n", names[old], names[i]);
+    exit(0);
+}
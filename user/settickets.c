@@ -13,6 +13,10 @@ int main(int argc, char *argv[])
 
     tickets = atoi(argv[1]);
 
-    settickets(tickets);
+    if (settickets(tickets) < 0)
+    {
+        fprintf(2, "settickets: bad number %s\n", argv[1]);
+        exit(1);
+    }
     exit(0);  
 }
@@ -0,0 +1,35 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// Run a command, or move a running process, on the cpus in a
+// mask: bit i, in decimal, for cpu i.
+int main(int argc, char *argv[])
+{
+    if (argc == 4 && strcmp(argv[1], "-p") == 0)
+    {
+        if (setaffinity(atoi(argv[2]), atoi(argv[3])) < 0)
+        {
+            fprintf(2, "taskset: rejected\n");
+            exit(1);
+        }
+        exit(0);
+    }
+
+    if (argc < 3)
+    {
+        fprintf(2, "usage: taskset mask command [args ...]\n");
+        fprintf(2, "       taskset -p pid mask\n");
+        exit(1);
+    }
+
+    if (setaffinity(0, atoi(argv[1])) < 0)
+    {
+        fprintf(2, "taskset: rejected\n");
+        exit(1);
+    }
+
+    exec(argv[2], &argv[2]);
+    fprintf(2, "taskset: exec %s failed\n", argv[2]);
+    exit(1);
+}
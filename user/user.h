@@ -1,4 +1,5 @@
 struct stat;
+struct lockstat;
 
 // system calls
 int fork(void);
@@ -28,6 +29,11 @@ int sigreturn(void);
 int set_priority(int, int);
 int settickets(int);
 int waitx(int*, int*, int*);
+int setsched(int);
+int setdeadline(int, int, int);
+int nanosleep(uint64);
+int setaffinity(int, int);
+int lockstat(struct lockstat*, int, int);
 // ulib.c
 int stat(const char*, struct stat*);
 char* strcpy(char*, const char*);
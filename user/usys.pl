@@ -41,4 +41,9 @@ entry("sigalarm");
 entry("sigreturn");
 entry("set_priority");
 entry("settickets");
-entry("waitx");
\ No newline at end of file
+entry("waitx");
+entry("setsched");
+entry("setdeadline");
+entry("nanosleep");
+entry("setaffinity");
+entry("lockstat");
\ No newline at end of file